@@ -138,7 +138,10 @@ _lthread_yield(struct lthread *lt)
 void
 _lthread_free(struct lthread *lt)
 {
-    free(lt->stack);
+    if (lt->stack != NULL) {
+        free(lt->stack);
+        _lthread_admit_release(lt->sched);
+    }
     free(lt);
 }
 
@@ -195,6 +198,11 @@ _lthread_resume(struct lthread *lt)
         if (lt->state & BIT(LT_ST_PENDING_RUNCOMPUTE)) {
             _lthread_compute_add(lt);
         }
+        /* lthread belongs to another scheduler from here on */
+        if (lt->state & BIT(LT_ST_PENDING_MIGRATE)) {
+            _lthread_migrate_push(lt);
+            return (-1);
+        }
     }
 
     return (0);
@@ -261,11 +269,19 @@ _lthread_init(struct lthread *lt)
 void
 _sched_free(struct lthread_sched *sched)
 {
+    _lthread_uring_free(sched);
+    _lthread_log_sched_free(sched);
     close(sched->poller_fd);
 
 #if ! (defined(__FreeBSD__) && defined(__APPLE__))
     close(sched->eventfd);
 #endif
+    if (sched->timerfd != -1)
+        close(sched->timerfd);
+    while (sched->nsplice_pipes-- > 0) {
+        close(sched->splice_pipes[sched->nsplice_pipes][0]);
+        close(sched->splice_pipes[sched->nsplice_pipes][1]);
+    }
     pthread_mutex_destroy(&sched->defer_mutex);
 
     free(sched);
@@ -284,6 +300,8 @@ sched_create(size_t stack_size)     // 虽然没有前下划线，但它不是
         perror("Failed to initialize scheduler\n");
         return (errno);
     }
+    /* 0 is a valid fd, the timerfd is only created on first use */
+    new_sched->timerfd = -1;
 
     assert(pthread_setspecific(lthread_sched_key, new_sched) == 0);
     _lthread_io_worker_init();
@@ -303,6 +321,7 @@ sched_create(size_t stack_size)     // 虽然没有前下划线，但它不是
 
     new_sched->stack_size = sched_stack_size;
     new_sched->page_size = getpagesize();
+    new_sched->numa_node = _lthread_self_node();
 
     new_sched->spawned_lthreads = 0;
     new_sched->default_timeout = 3000000u;
@@ -311,6 +330,9 @@ sched_create(size_t stack_size)     // 虽然没有前下划线，但它不是
     new_sched->birth = _lthread_usec_now();
     TAILQ_INIT(&new_sched->ready);
     TAILQ_INIT(&new_sched->defer);
+    TAILQ_INIT(&new_sched->migrate);
+    TAILQ_INIT(&new_sched->admit_queue);
+    TAILQ_INIT(&new_sched->admit_cond.blocked_lthreads);
     LIST_INIT(&new_sched->busy);
 
     bzero(&new_sched->ctx, sizeof(struct cpu_ctx));
@@ -318,35 +340,127 @@ sched_create(size_t stack_size)     // 虽然没有前下划线，但它不是
     return (0);
 }
 
-int
-lthread_create(struct lthread **new_lt, void *fun, void *arg)
+static struct lthread_sched *
+_lthread_sched_get_or_create(void)
 {
-    struct lthread *lt = NULL;
+    struct lthread_sched *sched = NULL;
+
     assert(pthread_once(&key_once, _lthread_key_create) == 0);
-    struct lthread_sched *sched = lthread_get_sched();
+    sched = lthread_get_sched();
 
     if (sched == NULL) {
         sched_create(0);
         sched = lthread_get_sched();
-        if (sched == NULL) {
+        if (sched == NULL)
             perror("Failed to create scheduler");
-            return (-1);
+    }
+
+    return (sched);
+}
+
+static int
+_lthread_alloc_stack(struct lthread *lt)
+{
+    struct lthread_sched *sched = lt->sched;
+
+    if (posix_memalign(&lt->stack, getpagesize(), sched->stack_size)) {
+        lt->stack = NULL;
+        return (-1);
+    }
+    /* keep the stack on our node even if it first faults in elsewhere */
+    _lthread_numa_bind(lt->stack, sched->stack_size, sched->numa_node);
+    lt->stack_size = sched->stack_size;
+    sched->live_lthreads++;
+
+    return (0);
+}
+
+/*
+ * Applies the scheduler's admission policy once it reached max_lthreads.
+ * Returns 0 if the new lthread can get a stack, 1 if its spawn has to be
+ * queued or -1 with errno set to EAGAIN if it's rejected.
+ */
+static int
+_lthread_admit(struct lthread_sched *sched)
+{
+    while (sched->max_lthreads &&
+        sched->live_lthreads >= sched->max_lthreads) {
+
+        if (sched->admit_policy == LTHREAD_ADMIT_QUEUE &&
+            (sched->max_queued == 0 ||
+            sched->queued_lthreads < sched->max_queued))
+            return (1);
+
+        /* only an lthread can wait, others fail like LTHREAD_ADMIT_FAIL */
+        if (sched->admit_policy == LTHREAD_ADMIT_BLOCK &&
+            sched->current_lthread != NULL) {
+            sched->admit_blocked++;
+            lthread_cond_wait(&sched->admit_cond, 0);
+            continue;
         }
+
+        sched->admit_rejected++;
+        errno = EAGAIN;
+        return (-1);
     }
 
+    return (0);
+}
+
+/*
+ * Called when an lthread stack is released. Hands the slot to the oldest
+ * queued spawn, or wakes up an lthread blocked in lthread_create().
+ */
+void
+_lthread_admit_release(struct lthread_sched *sched)
+{
+    struct lthread *lt = NULL;
+
+    sched->live_lthreads--;
+    if (sched->max_lthreads && sched->live_lthreads >= sched->max_lthreads)
+        return;
+
+    lt = TAILQ_FIRST(&sched->admit_queue);
+    if (lt == NULL) {
+        lthread_cond_signal(&sched->admit_cond);
+        return;
+    }
+
+    /* leave it queued and retry on the next release if we are out of memory */
+    if (_lthread_alloc_stack(lt) == -1)
+        return;
+
+    TAILQ_REMOVE(&sched->admit_queue, lt, ready_next);
+    sched->queued_lthreads--;
+    lt->state &= CLEARBIT(LT_ST_ADMIT_QUEUED);
+    TAILQ_INSERT_TAIL(&sched->ready, lt, ready_next);
+}
+
+int
+lthread_create(struct lthread **new_lt, lthread_func fun, void *arg)
+{
+    struct lthread *lt = NULL;
+    struct lthread_sched *sched = _lthread_sched_get_or_create();
+    int queue = 0;
+
+    if (sched == NULL)
+        return (-1);
+
+    if ((queue = _lthread_admit(sched)) == -1)
+        return (errno);
+
     if ((lt = calloc(1, sizeof(struct lthread))) == NULL) {
         perror("Failed to allocate memory for new lthread");
         return (errno);
     }
 
-    if (posix_memalign(&lt->stack, getpagesize(), sched->stack_size)) {
+    lt->sched = sched;
+    if (!queue && _lthread_alloc_stack(lt) == -1) {
         free(lt);
         perror("Failed to allocate stack for new lthread");
         return (errno);
     }
 
-    lt->sched = sched;
-    lt->stack_size = sched->stack_size;
     lt->state = BIT(LT_ST_NEW);
     lt->id = sched->spawned_lthreads++;  
     lt->fun = fun;
@@ -354,11 +468,75 @@ lthread_create(struct lthread **new_lt, void *fun, void *arg)
     lt->arg = arg;
     lt->birth = _lthread_usec_now();
     *new_lt = lt;
+    sched->created_lthreads++;
+
+    /* no stack yet, it gets one when a running lthread frees up its slot */
+    if (queue) {
+        lt->state |= BIT(LT_ST_ADMIT_QUEUED);
+        sched->queued_lthreads++;
+        sched->admit_queued++;
+        TAILQ_INSERT_TAIL(&sched->admit_queue, lt, ready_next);
+        return (0);
+    }
+
     TAILQ_INSERT_TAIL(&lt->sched->ready, lt, ready_next);
 
     return (0);
 }
 
+/*
+ * Caps the number of lthreads holding a stack in the current scheduler.
+ * Once max_lthreads is reached lthread_create() applies `policy`: fail with
+ * EAGAIN, block the calling lthread until a slot frees up, or queue the
+ * spawn without allocating a stack (up to max_queued spawns, 0 for no
+ * limit). max_lthreads 0 removes the cap.
+ */
+int
+lthread_sched_set_limit(size_t max_lthreads, enum lthread_admit_policy policy,
+    size_t max_queued)
+{
+    struct lthread_sched *sched = _lthread_sched_get_or_create();
+
+    if (sched == NULL)
+        return (-1);
+
+    if (policy != LTHREAD_ADMIT_FAIL && policy != LTHREAD_ADMIT_BLOCK &&
+        policy != LTHREAD_ADMIT_QUEUE) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    sched->max_lthreads = max_lthreads;
+    sched->admit_policy = policy;
+    sched->max_queued = max_queued;
+
+    return (0);
+}
+
+void
+lthread_sched_stats(struct lthread_sched_stats *stats)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+
+    bzero(stats, sizeof(*stats));
+    if (sched == NULL)
+        return;
+
+    stats->live_lthreads = sched->live_lthreads;
+    stats->queued_lthreads = sched->queued_lthreads;
+    stats->created = sched->created_lthreads;
+    stats->rejected = sched->admit_rejected;
+    stats->blocked = sched->admit_blocked;
+    stats->queued = sched->admit_queued;
+    stats->iterations = sched->stats_iterations;
+    stats->ready_resumed = sched->stats_ready_resumed;
+    stats->ready_max = sched->stats_ready_max;
+    stats->ready_usecs_max = sched->stats_ready_usecs_max;
+    stats->budget_exhausted = sched->stats_budget_exhausted;
+    stats->events = sched->stats_events;
+    stats->events_max = sched->stats_events_max;
+}
+
 void
 lthread_set_data(void *data)
 {
@@ -384,16 +562,25 @@ lthread_cancel(struct lthread *lt)
         return;
 
     lt->state |= BIT(LT_ST_CANCELLED);
+    /* a queued spawn never got a stack, just drop it from the queue */
+    if (lt->state & BIT(LT_ST_ADMIT_QUEUED)) {
+        TAILQ_REMOVE(&lt->sched->admit_queue, lt, ready_next);
+        lt->sched->queued_lthreads--;
+        lt->state &= CLEARBIT(LT_ST_ADMIT_QUEUED);
+    }
     _lthread_desched_sleep(lt);
     _lthread_cancel_event(lt);
     /*
      * we don't schedule the cancelled lthread if it was running in a compute
-     * scheduler or pending to run in a compute scheduler or in an io worker.
+     * scheduler or pending to run in a compute scheduler, waiting on compute
+     * tasks or a future, or in an io worker.
      * otherwise it could get freed while it's still running.
      * when it's done in compute_scheduler, or io_worker - the scheduler will
      * attempt to run it and realize it's cancelled and abort the resumption.
      */
     if (lt->state & BIT(LT_ST_PENDING_RUNCOMPUTE) ||
+        lt->state & BIT(LT_ST_WAIT_COMPUTE) ||
+        lt->state & BIT(LT_ST_WAIT_FUTURE) ||
         lt->state & BIT(LT_ST_WAIT_IO_READ) ||
         lt->state & BIT(LT_ST_WAIT_IO_WRITE) ||
         lt->state & BIT(LT_ST_RUNCOMPUTE))
@@ -415,11 +602,17 @@ lthread_cond_create(struct lthread_cond **c)
 // NOTE: 等待条件变量的阻塞被设置为busy状态
 int
 lthread_cond_wait(struct lthread_cond *c, uint64_t timeout)
+{
+    return (lthread_cond_wait_us(c, timeout * 1000u));
+}
+
+int
+lthread_cond_wait_us(struct lthread_cond *c, uint64_t timeout)
 {
     struct lthread *lt = lthread_get_sched()->current_lthread;
     TAILQ_INSERT_TAIL(&c->blocked_lthreads, lt, cond_next);
 
-    _lthread_sched_busy_sleep(lt, timeout);       // NOTE
+    _lthread_sched_busy_sleep_us(lt, timeout);       // NOTE
 
     if (lt->state & BIT(LT_ST_EXPIRED)) {          
         TAILQ_REMOVE(&c->blocked_lthreads, lt, cond_next);
@@ -456,14 +649,20 @@ lthread_cond_broadcast(struct lthread_cond *c)
 // 如果msec为0会直接把它加入到ready队列中去
 void
 lthread_sleep(uint64_t msecs)
+{
+    lthread_usleep(msecs * 1000u);
+}
+
+void
+lthread_usleep(uint64_t usecs)
 {
     struct lthread *lt = lthread_get_sched()->current_lthread;
 
-    if (msecs == 0) {
+    if (usecs == 0) {
         TAILQ_INSERT_TAIL(&lt->sched->ready, lt, ready_next);
         _lthread_yield(lt);
     } else {
-        _lthread_sched_sleep(lt, msecs);
+        _lthread_sched_sleep_us(lt, usecs);
     }
 }
 
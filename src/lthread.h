@@ -31,8 +31,11 @@
 #define LTHREAD_H
 
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netdb.h>
 #include <stdint.h>
 #include <poll.h>
 
@@ -41,13 +44,106 @@
 #ifndef LTHREAD_INT_H
 struct lthread;
 struct lthread_cond;
+struct lthread_sched;
 typedef struct lthread lthread_t;
 typedef struct lthread_cond lthread_cond_t;
+typedef struct lthread_sched lthread_sched_t;
 #endif
 
 char    *lthread_summary();
 
 typedef void (*lthread_func)(void *);
+typedef struct lthread_compute_group lthread_compute_group_t;
+typedef struct lthread_compute_pool lthread_compute_pool_t;
+typedef struct lthread_future lthread_future_t;
+typedef struct lthread_commit lthread_commit_t;
+typedef struct lthread_io_buf_pool lthread_io_buf_pool_t;
+typedef struct lthread_file_stream lthread_file_stream_t;
+typedef void (*lthread_compute_fn)(void *arg);
+typedef void (*lthread_compute_range_fn)(size_t begin, size_t end,
+    void *ctx);
+
+enum lthread_admit_policy {
+    LTHREAD_ADMIT_FAIL,     /* lthread_create() fails with EAGAIN */
+    LTHREAD_ADMIT_BLOCK,    /* the creating lthread waits for a free slot */
+    LTHREAD_ADMIT_QUEUE     /* spawn is queued, stack allocated later */
+};
+
+struct lthread_sched_stats {
+    uint64_t    live_lthreads;      /* lthreads holding a stack */
+    uint64_t    queued_lthreads;    /* spawns currently waiting for a slot */
+    uint64_t    created;            /* successful lthread_create() calls */
+    uint64_t    rejected;           /* lthread_create() calls refused */
+    uint64_t    blocked;            /* times a creator had to wait */
+    uint64_t    queued;             /* spawns that had to be queued */
+    uint64_t    iterations;         /* scheduler loop iterations */
+    uint64_t    ready_resumed;      /* lthreads resumed from the ready queue */
+    uint64_t    ready_max;          /* most ready lthreads run in an iteration */
+    uint64_t    ready_usecs_max;    /* longest ready queue pass */
+    uint64_t    budget_exhausted;   /* passes cut short by the budget */
+    uint64_t    events;             /* poller events received */
+    uint64_t    events_max;         /* most events received in one poll */
+};
+
+struct lthread_compute_stats {
+    uint64_t    workers;            /* compute pthreads in the pool */
+    uint64_t    idle_workers;       /* workers waiting for work */
+    uint64_t    queued;             /* compute blocks waiting for a worker */
+    uint64_t    queued_max;         /* deepest the queue has been */
+    uint64_t    submitted;          /* lthread_compute_begin() calls and tasks */
+    uint64_t    rejected;           /* calls refused by the queue limit */
+    uint64_t    scaled_up;          /* workers added for a backed up queue */
+    uint64_t    scaled_down;        /* workers retired after idling */
+    uint64_t    wait_usecs_total;   /* time spent queued, summed */
+    uint64_t    wait_usecs_max;     /* longest time spent queued */
+};
+
+struct lthread_io_stats {
+    uint64_t    depth;              /* requests queued or running */
+    uint64_t    depth_max;          /* deepest the queue has been */
+    uint64_t    completed;          /* requests done */
+    uint64_t    latency_usecs_total; /* submit to completion, summed */
+    uint64_t    latency_usecs_max;  /* slowest request */
+};
+
+enum lthread_log_policy {
+    LTHREAD_LOG_DROP,       /* a message that doesn't fit is dropped */
+    LTHREAD_LOG_WAIT        /* the logging lthread waits for the flusher */
+};
+
+struct lthread_log_config {
+    size_t      ring_size;          /* bytes buffered per scheduler, 64k */
+    size_t      flush_bytes;        /* buffered bytes that trigger a flush */
+    uint64_t    flush_interval;     /* msecs between flushes, 100 */
+    int         policy;             /* enum lthread_log_policy */
+};
+
+struct lthread_log_stats {
+    uint64_t    written;            /* messages buffered */
+    uint64_t    dropped;            /* messages lost to full rings or errors */
+    uint64_t    flushes;            /* writev() batches */
+    uint64_t    bytes;              /* bytes written to the log fd */
+};
+
+struct lthread_io_buf_stats {
+    uint64_t    bufs;               /* buffers in the pool */
+    uint64_t    free;               /* buffers not lent out */
+    uint64_t    borrowed;           /* lthread_io_buf_get() calls */
+    uint64_t    waited;             /* borrowers that found the pool empty */
+};
+
+struct lthread_commit_stats {
+    uint64_t    appends;            /* records appended */
+    uint64_t    syncs;              /* fdatasync rounds that covered them */
+};
+
+struct lthread_compute_pool_config {
+    size_t      min_workers;        /* started right away, never retired */
+    size_t      max_workers;        /* scaling limit, 0 for one per cpu */
+    uint64_t    idle_timeout;       /* msecs before an extra worker exits */
+    size_t      scale_queued;       /* queued items per worker to scale up */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -55,20 +151,33 @@ extern "C" {
 int     lthread_create(lthread_t **new_lt, lthread_func, void *arg);
 void    lthread_cancel(lthread_t *lt);
 void    lthread_run(void);
+int     lthread_run_once(uint64_t timeout);
+int     lthread_sched_poller_fd(void);
+int     lthread_sched_timeout(void);
 int     lthread_join(lthread_t *lt, void **ptr, uint64_t timeout);
 void    lthread_detach(void);
 void    lthread_detach2(lthread_t *lt);
 void    lthread_exit(void *ptr);
 void    lthread_sleep(uint64_t msecs);
+void    lthread_usleep(uint64_t usecs);
 void    lthread_wakeup(lthread_t *lt);
 int     lthread_cond_create(lthread_cond_t **c);
 int     lthread_cond_wait(lthread_cond_t *c, uint64_t timeout);
+int     lthread_cond_wait_us(lthread_cond_t *c, uint64_t timeout_us);
 void    lthread_cond_signal(lthread_cond_t *c);
 void    lthread_cond_broadcast(lthread_cond_t *c);
 int     lthread_init(size_t size);
 void    *lthread_get_data(void);
 void    lthread_set_data(void *data);
 lthread_t *lthread_current();
+lthread_sched_t *lthread_sched_self(void);
+int     lthread_migrate(lthread_t *lt, lthread_sched_t *sched);
+int     lthread_migrate_self(lthread_sched_t *sched);
+int     lthread_sched_set_limit(size_t max_lthreads,
+    enum lthread_admit_policy policy, size_t max_queued);
+void    lthread_sched_stats(struct lthread_sched_stats *stats);
+int     lthread_sched_set_budget(uint32_t max_lthreads, uint64_t max_usecs);
+int     lthread_sched_set_pwait2(int enable);
 
 /* socket related functions */
 int     lthread_socket(int, int, int);
@@ -99,16 +208,151 @@ ssize_t lthread_sendto(int fd, const void *buf, size_t length, int flags,
 ssize_t lthread_writev(int fd, struct iovec *iov, int iovcnt);
 int     lthread_wait_read(int fd, int timeout_ms);
 int     lthread_wait_write(int fd, int timeout_ms);
+
+/* same as above with timeouts in usecs */
+int     lthread_connect_us(int fd, struct sockaddr *, socklen_t,
+    uint64_t timeout_us);
+ssize_t lthread_recv_us(int fd, void *buf, size_t buf_len, int flags,
+    uint64_t timeout_us);
+ssize_t lthread_read_us(int fd, void *buf, size_t length,
+    uint64_t timeout_us);
+ssize_t lthread_recv_exact_us(int fd, void *buf, size_t buf_len, int flags,
+    uint64_t timeout_us);
+ssize_t lthread_read_exact_us(int fd, void *buf, size_t length,
+    uint64_t timeout_us);
+ssize_t lthread_recvmsg_us(int fd, struct msghdr *message, int flags,
+    uint64_t timeout_us);
+ssize_t lthread_recvfrom_us(int fd, void *buf, size_t length, int flags,
+    struct sockaddr *address, socklen_t *address_len, uint64_t timeout_us);
+int     lthread_wait_read_us(int fd, uint64_t timeout_us);
+int     lthread_wait_write_us(int fd, uint64_t timeout_us);
 #ifdef __FreeBSD__
 int     lthread_sendfile(int fd, int s, off_t offset, size_t nbytes,
     struct sf_hdtr *hdtr);
+#elif defined(__linux__)
+ssize_t lthread_sendfile(int fd, int s, off_t offset, size_t nbytes);
+ssize_t lthread_splice(int fd_in, int fd_out, size_t len);
 #endif
 ssize_t lthread_io_write(int fd, void *buf, size_t nbytes);
 ssize_t lthread_io_read(int fd, void *buf, size_t nbytes);
+ssize_t lthread_io_pread(int fd, void *buf, size_t nbytes, off_t offset);
+ssize_t lthread_io_pwrite(int fd, const void *buf, size_t nbytes,
+    off_t offset);
+ssize_t lthread_io_readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t lthread_io_writev(int fd, const struct iovec *iov, int iovcnt);
+int     lthread_io_fsync(int fd);
+int     lthread_io_fdatasync(int fd);
+int     lthread_io_open(const char *path, int flags, ...);
+int     lthread_io_stat(const char *path, struct stat *st);
+int     lthread_io_fstat(int fd, struct stat *st);
+int     lthread_io_close(int fd);
+int     lthread_io_unlink(const char *path);
+
+/* O_DIRECT io with buffers borrowed from an aligned pool */
+int     lthread_io_open_direct(const char *path, int flags, ...);
+int     lthread_io_buf_pool_create(lthread_io_buf_pool_t **pool, size_t size,
+    size_t nbufs, size_t align);
+void    *lthread_io_buf_get(lthread_io_buf_pool_t *pool);
+void    lthread_io_buf_put(lthread_io_buf_pool_t *pool, void *buf);
+size_t  lthread_io_buf_size(lthread_io_buf_pool_t *pool);
+void    lthread_io_buf_pool_stats(lthread_io_buf_pool_t *pool,
+    struct lthread_io_buf_stats *stats);
+void    lthread_io_buf_pool_free(lthread_io_buf_pool_t *pool);
+
+/* sequential reads with chunks read ahead on the io workers */
+int     lthread_file_stream_open(lthread_file_stream_t **s, int fd,
+    off_t offset, size_t chunk, int depth);
+ssize_t lthread_file_stream_read(lthread_file_stream_t *s, void **buf);
+void    lthread_file_stream_close(lthread_file_stream_t *s);
+
+/* name resolution on the io workers, answers cached for a ttl */
+int     lthread_getaddrinfo(const char *node, const char *service,
+    const struct addrinfo *hints, struct addrinfo **res);
+void    lthread_freeaddrinfo(struct addrinfo *res);
+void    lthread_getaddrinfo_set_ttl(uint64_t msecs);
+
 int lthread_poll(struct pollfd *fds, nfds_t nfds, int timeout);
 
 int lthread_compute_begin(void);
 void lthread_compute_end(void);
+int lthread_compute_set_workers(size_t nworkers);
+void lthread_compute_stats(struct lthread_compute_stats *stats);
+int lthread_compute_group_create(lthread_compute_group_t **group);
+int lthread_compute_group_spawn(lthread_compute_group_t *group,
+    lthread_compute_fn fn, void *arg);
+int lthread_compute_group_wait(lthread_compute_group_t *group);
+void lthread_compute_group_free(lthread_compute_group_t *group);
+int lthread_compute_parallel_for(size_t begin, size_t end, size_t grain,
+    lthread_compute_range_fn fn, void *ctx);
+int lthread_compute_call(void *(*fn)(void *), void *arg, void **result);
+
+/* named compute pools */
+int lthread_compute_pool_create(lthread_compute_pool_t **pool,
+    const char *name, size_t nworkers, size_t max_queued, const int *cpus,
+    int ncpus);
+lthread_compute_pool_t *lthread_compute_pool_find(const char *name);
+int lthread_compute_pool_set_workers(lthread_compute_pool_t *pool,
+    size_t nworkers);
+int lthread_compute_pool_configure(lthread_compute_pool_t *pool,
+    const struct lthread_compute_pool_config *config);
+int lthread_compute_configure(const struct lthread_compute_pool_config *config);
+void lthread_compute_pool_stats(lthread_compute_pool_t *pool,
+    struct lthread_compute_stats *stats);
+int lthread_compute_begin_pool(lthread_compute_pool_t *pool);
+int lthread_compute_group_create_pool(lthread_compute_group_t **group,
+    lthread_compute_pool_t *pool);
+int lthread_compute_call_pool(lthread_compute_pool_t *pool,
+    void *(*fn)(void *), void *arg, void **result);
+int lthread_compute_parallel_for_pool(lthread_compute_pool_t *pool,
+    size_t begin, size_t end, size_t grain, lthread_compute_range_fn fn,
+    void *ctx);
+
+/* futures for work offloaded to compute pools and io workers */
+int     lthread_future_create(lthread_future_t **f);
+int     lthread_future_set(lthread_future_t *f, void *result, int err);
+int     lthread_future_compute(lthread_future_t **f, void *(*fn)(void *),
+    void *arg);
+int     lthread_future_compute_pool(lthread_future_t **f,
+    lthread_compute_pool_t *pool, void *(*fn)(void *), void *arg);
+int     lthread_future_io_read(lthread_future_t **f, int fd, void *buf,
+    size_t nbytes);
+int     lthread_future_io_write(lthread_future_t **f, int fd, void *buf,
+    size_t nbytes);
+int     lthread_future_io_pread(lthread_future_t **f, int fd, void *buf,
+    size_t nbytes, off_t offset);
+int     lthread_future_done(lthread_future_t *f);
+int     lthread_future_wait(lthread_future_t *f, uint64_t timeout);
+int     lthread_future_wait_any(lthread_future_t **fs, int n,
+    uint64_t timeout);
+void    *lthread_future_result(lthread_future_t *f);
+int     lthread_future_error(lthread_future_t *f);
+void    lthread_future_free(lthread_future_t *f);
+
+/* group commit, one fdatasync for every append that arrived meanwhile */
+int     lthread_commit_create(lthread_commit_t **c, int fd);
+ssize_t lthread_commit_append(lthread_commit_t *c, const void *buf,
+    size_t nbytes);
+int     lthread_commit_sync(lthread_commit_t *c);
+void    lthread_commit_stats(lthread_commit_t *c,
+    struct lthread_commit_stats *stats);
+void    lthread_commit_free(lthread_commit_t *c);
+
+/* buffered logging, written out by a flusher pthread */
+int     lthread_log_init(int fd, const struct lthread_log_config *config);
+int     lthread_log(const char *fmt, ...);
+int     lthread_log_write(const void *buf, size_t nbytes);
+int     lthread_log_flush(void);
+void    lthread_log_close(void);
+void    lthread_log_stats(struct lthread_log_stats *stats);
+
+/* cpu affinity and numa placement */
+int     lthread_set_cpu(int cpu);
+int     lthread_numa_node(void);
+int     lthread_compute_set_cpus(const int *cpus, int ncpus);
+int     lthread_io_set_cpus(const int *cpus, int ncpus);
+int     lthread_io_set_uring(int enable);
+int     lthread_io_set_workers(int nworkers);
+int     lthread_io_stats(struct lthread_io_stats *stats, int nstats);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,238 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * lthread_affinity.c
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "lthread_int.h"
+#include "lthread_affinity.h"
+
+/* libnuma is not a dependency, mbind(2) is issued directly */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED  1
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE    (1 << 1)
+#endif
+
+/*
+ * Builds a cpu_set_t from an array of cpu ids. Returns 0 on success or -1
+ * with errno set to EINVAL if a cpu id is out of range or the set is empty.
+ */
+int
+_lthread_cpus_to_set(const int *cpus, int ncpus, cpu_set_t *set)
+{
+    int i = 0;
+
+    CPU_ZERO(set);
+    for (i = 0; i < ncpus; i++) {
+        if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+            errno = EINVAL;
+            return (-1);
+        }
+        CPU_SET(cpus[i], set);
+    }
+
+    if (CPU_COUNT(set) == 0) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    return (0);
+}
+
+/* cpu id to numa node, -1 where unknown, read from sysfs once */
+static signed char cpu_nodes[CPU_SETSIZE];
+static pthread_once_t cpu_nodes_once = PTHREAD_ONCE_INIT;
+
+/* marks the cpus of a cpulist such as "0-3,8-11" as belonging to node */
+static void
+_lthread_parse_cpulist(FILE *fp, int node)
+{
+    int first = 0, last = 0, c = 0;
+
+    while (fscanf(fp, "%d", &first) == 1) {
+        last = first;
+        if ((c = fgetc(fp)) == '-') {
+            if (fscanf(fp, "%d", &last) != 1)
+                return;
+            c = fgetc(fp);
+        }
+        for (; first <= last; first++)
+            if (first >= 0 && first < CPU_SETSIZE)
+                cpu_nodes[first] = node;
+        if (c != ',')
+            return;
+    }
+}
+
+static void
+_lthread_cpu_nodes_init(void)
+{
+    char path[64];
+    FILE *fp = NULL;
+    int node = 0;
+
+    memset(cpu_nodes, -1, sizeof(cpu_nodes));
+    for (node = 0; node < LT_MAX_NUMA_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+            node);
+        if ((fp = fopen(path, "r")) == NULL)
+            continue;
+        _lthread_parse_cpulist(fp, node);
+        fclose(fp);
+    }
+}
+
+/*
+ * Returns the numa node `cpu` belongs to, or -1 if the kernel doesn't
+ * expose numa topology.
+ */
+int
+_lthread_cpu_node(int cpu)
+{
+    assert(pthread_once(&cpu_nodes_once, _lthread_cpu_nodes_init) == 0);
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return (-1);
+
+    return (cpu_nodes[cpu]);
+}
+
+/*
+ * Returns the node shared by every cpu in `set`, or -1 if the set spans
+ * more than one node.
+ */
+int
+_lthread_cpuset_node(const cpu_set_t *set)
+{
+    int cpu = 0;
+    int node = -1;
+    int tmp = 0;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        tmp = _lthread_cpu_node(cpu);
+        if (tmp == -1 || (node != -1 && tmp != node))
+            return (-1);
+        node = tmp;
+    }
+
+    return (node);
+}
+
+/*
+ * Returns the node the calling pthread is pinned to, or -1 if it can run on
+ * more than one node.
+ */
+int
+_lthread_self_node(void)
+{
+    cpu_set_t set;
+
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) != 0)
+        return (-1);
+
+    return (_lthread_cpuset_node(&set));
+}
+
+void
+_lthread_node_cpuset(int node, cpu_set_t *set)
+{
+    int cpu = 0;
+    int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+
+    CPU_ZERO(set);
+    for (cpu = 0; cpu < ncpus && cpu < CPU_SETSIZE; cpu++)
+        if (_lthread_cpu_node(cpu) == node)
+            CPU_SET(cpu, set);
+}
+
+/*
+ * Prefers `node` for the pages backing [addr, addr + len). addr must be page
+ * aligned. Pages already faulted in elsewhere are moved. This is best effort,
+ * on kernels without numa support mbind fails and we simply carry on.
+ */
+void
+_lthread_numa_bind(void *addr, size_t len, int node)
+{
+    unsigned long nodemask = 0;
+
+    if (node < 0 || node >= LT_MAX_NUMA_NODES)
+        return;
+
+    nodemask = 1UL << node;
+    syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &nodemask,
+        sizeof(nodemask) * 8, MPOL_MF_MOVE);
+}
+
+/*
+ * Pins the calling pthread to `cpu`. If the pthread already has a scheduler,
+ * new lthread stacks get allocated on the node of that cpu from now on.
+ * Call it before lthread_create() to have the scheduler itself allocated on
+ * the local node.
+ */
+int
+lthread_set_cpu(int cpu)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    cpu_set_t set;
+
+    if (_lthread_cpus_to_set(&cpu, 1, &set) == -1)
+        return (-1);
+
+    if ((errno = pthread_setaffinity_np(pthread_self(),
+        sizeof(cpu_set_t), &set)) != 0)
+        return (-1);
+
+    if (sched != NULL)
+        sched->numa_node = _lthread_cpu_node(cpu);
+
+    return (0);
+}
+
+/*
+ * Returns the numa node of the current scheduler or -1 if it is unknown or
+ * the scheduler isn't pinned to a single node.
+ */
+int
+lthread_numa_node(void)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+
+    return (sched ? sched->numa_node : -1);
+}
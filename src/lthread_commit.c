@@ -0,0 +1,182 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * lthread_commit.c
+ *
+ * Group commit for durable appends. Lthreads append their records and wait
+ * on the next sync round; a round is a single fdatasync() run on an io
+ * worker that covers every record written before it started. While a round
+ * is in flight new arrivals gather in the next one, which starts as soon as
+ * the current one completes, so a burst of appends costs a couple of syncs.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lthread_int.h"
+
+struct lthread_commit {
+    pthread_mutex_t     mutex;
+    int                 fd;
+    int                 syncing;        /* a round is in flight */
+    struct lthread_future *round;       /* completes with the inflight sync */
+    struct lthread_future *next;        /* round new arrivals wait on */
+    struct lthread_io_req sync;         /* the inflight fdatasync */
+    uint64_t            appends;
+    uint64_t            syncs;
+};
+
+static void _lthread_commit_synced(struct lthread_io_req *req);
+
+/* starts a sync for the records waiting on c->next, with c->mutex held */
+static void
+_lthread_commit_start(struct lthread_commit *c)
+{
+    c->syncing = 1;
+    c->round = c->next;
+    c->next = NULL;
+    c->syncs++;
+
+    memset(&c->sync, 0, sizeof(c->sync));
+    c->sync.op = LT_IO_FDATASYNC;
+    c->sync.fd = c->fd;
+    c->sync.done = _lthread_commit_synced;
+    c->sync.arg = c;
+    _lthread_io_submit(&c->sync);
+}
+
+/* called by the io worker once a round's fdatasync returned */
+static void
+_lthread_commit_synced(struct lthread_io_req *req)
+{
+    struct lthread_commit *c = req->arg;
+    struct lthread_future *round = NULL;
+    intptr_t ret = req->ret;
+    int err = req->err;
+
+    assert(pthread_mutex_lock(&c->mutex) == 0);
+    round = c->round;
+    c->round = NULL;
+    c->syncing = 0;
+    /* whoever arrived during this sync goes next, right away */
+    if (c->next != NULL)
+        _lthread_commit_start(c);
+    assert(pthread_mutex_unlock(&c->mutex) == 0);
+
+    lthread_future_set(round, (void *)ret, err);
+    lthread_future_free(round);
+}
+
+/*
+ * Creates a group commit for fd, which should be open with O_APPEND when
+ * several lthreads append to it.
+ */
+int
+lthread_commit_create(struct lthread_commit **c, int fd)
+{
+    if ((*c = calloc(1, sizeof(struct lthread_commit))) == NULL)
+        return (-1);
+
+    assert(pthread_mutex_init(&(*c)->mutex, NULL) == 0);
+    (*c)->fd = fd;
+
+    return (0);
+}
+
+/*
+ * Waits until everything written to the commit's fd so far is on stable
+ * storage, sharing the fdatasync with every lthread that asks meanwhile.
+ */
+int
+lthread_commit_sync(struct lthread_commit *c)
+{
+    struct lthread_future *round = NULL;
+    int ret = 0;
+
+    assert(pthread_mutex_lock(&c->mutex) == 0);
+    if (c->next == NULL && lthread_future_create(&c->next) == -1) {
+        assert(pthread_mutex_unlock(&c->mutex) == 0);
+        return (-1);
+    }
+    round = c->next;
+    _lthread_future_hold(round);
+    /* nothing in flight, lead this round ourselves */
+    if (!c->syncing)
+        _lthread_commit_start(c);
+    assert(pthread_mutex_unlock(&c->mutex) == 0);
+
+    lthread_future_wait(round, 0);
+    if ((ret = (int)(intptr_t)lthread_future_result(round)) == -1)
+        errno = lthread_future_error(round);
+    lthread_future_free(round);
+
+    return (ret);
+}
+
+/*
+ * Writes buf to the commit's fd and returns once it is durable. Returns
+ * what write(2) did, or -1 if the write or the sync failed.
+ */
+ssize_t
+lthread_commit_append(struct lthread_commit *c, const void *buf,
+    size_t nbytes)
+{
+    ssize_t ret = 0;
+
+    if ((ret = lthread_io_write(c->fd, (void *)buf, nbytes)) == -1)
+        return (-1);
+    __atomic_add_fetch(&c->appends, 1, __ATOMIC_RELAXED);
+
+    if (lthread_commit_sync(c) == -1)
+        return (-1);
+
+    return (ret);
+}
+
+void
+lthread_commit_stats(struct lthread_commit *c,
+    struct lthread_commit_stats *stats)
+{
+    assert(pthread_mutex_lock(&c->mutex) == 0);
+    stats->appends = __atomic_load_n(&c->appends, __ATOMIC_RELAXED);
+    stats->syncs = c->syncs;
+    assert(pthread_mutex_unlock(&c->mutex) == 0);
+}
+
+/* c must be idle: no lthread appending or syncing on it */
+void
+lthread_commit_free(struct lthread_commit *c)
+{
+    assert(!c->syncing && c->next == NULL);
+    assert(pthread_mutex_destroy(&c->mutex) == 0);
+    free(c);
+}
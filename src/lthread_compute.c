@@ -26,6 +26,10 @@
  * lthread_compute.c
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/queue.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,83 +40,313 @@
 #include <sys/uio.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <errno.h>
 
 #include "lthread_int.h"
+#include "lthread_affinity.h"
 
-enum {THREAD_TIMEOUT_BEFORE_EXIT = 60};
 static pthread_key_t compute_sched_key;
 static pthread_once_t key_once = PTHREAD_ONCE_INIT;
 
-LIST_HEAD(compute_sched_l, lthread_compute_sched) compute_scheds = \
-    LIST_HEAD_INITIALIZER(compute_scheds);                 // lmy: 存放compute sched的链表
-pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Compute pools. Each pool runs between min_workers and max_workers compute
+ * pthreads (workers). A sized pool keeps both at its size. An unsized one
+ * starts a single worker the first time it's needed, adds workers up to one
+ * per cpu while lthreads queue up, and retires the extra ones after they
+ * idle for idle_timeout; lthread_compute_pool_configure() sets the bounds.
+ * Pools don't share workers or queues, so a burst of work on one doesn't
+ * delay the others. Every worker owns a ring of lthreads to run that
+ * schedulers push onto without taking a lock; a worker that runs out of
+ * work steals from the other rings before going to sleep. lthreads that
+ * find their ring full wait in the pool's queue instead.
+ *
+ * Besides whole lthreads the rings carry tasks, plain function calls that
+ * run on the worker's own stack. Tasks belong to a group the spawning
+ * lthread parks on until all of them are done.
+ *
+ * An lthread entering compute is only marked LT_ST_PENDING_RUNCOMPUTE in
+ * lthread_compute_begin(). Its scheduler pushes it to a worker from
+ * _lthread_resume() once it switched off the lthread's stack, so a worker
+ * never sees an lthread it can't run yet and never has to wait for one.
+ *
+ * Worker structs are never freed, a slot retired by shrinking the pool is
+ * reused when it grows again. The pool mutex only serializes resizing.
+ */
+enum {LT_COMPUTE_MAX_WORKERS = 256};
+enum {LT_COMPUTE_RING_SIZE = 256};    /* power of 2 */
+enum {LT_COMPUTE_MASK_WORDS = LT_COMPUTE_MAX_WORKERS / 64};
+enum {LT_COMPUTE_IDLE_TIMEOUT = 60000};  /* msecs */
+
+struct lthread_compute_task {
+    lthread_compute_fn  fn;
+    void                *arg;
+    struct lthread_compute_group *group;
+    uint64_t            queued;             /* when it was queued */
+    int                 embedded;           /* part of a bigger allocation */
+    TAILQ_ENTRY(lthread_compute_task) next;
+};
+
+TAILQ_HEAD(lthread_compute_task_q, lthread_compute_task);
+
+/*
+ * pending counts the tasks not done yet plus one reference held by the
+ * waiter until it waits, whoever drops it to 0 wakes the waiter or doesn't
+ * have to park.
+ */
+struct lthread_compute_group {
+    size_t              pending;
+    struct lthread      *waiter;
+    struct lthread_compute_pool *pool;
+    /* a waiter outside an lthread blocks on cond until done is set */
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    int                 done;
+};
+
+/* one of the two is set */
+struct lthread_compute_item {
+    struct lthread      *lt;
+    struct lthread_compute_task *task;
+};
+
+struct lthread_compute_pool {
+    char                name[32];
+    pthread_mutex_t     mutex;              /* serializes resizing */
+    struct lthread_compute_sched *slots[LT_COMPUTE_MAX_WORKERS];
+    size_t              nslots;             /* slots ever used */
+    size_t              workers;            /* slots [0, workers) are live */
+    size_t              size;               /* workers we want right now */
+    size_t              min_workers;        /* never retired for idling */
+    size_t              max_workers;        /* 0 until sized or first used */
+    uint64_t            idle_timeout;       /* msecs, 0 to never retire */
+    size_t              scale_queued;       /* items per worker to scale up */
+    size_t              max_queued;         /* 0 for no limit */
+    size_t              rr;
+
+    /*
+     * Workers waiting for work have their bit set in idle_mask. A scheduler
+     * hands an item to one by clearing its bit, whoever clears it first owns
+     * the handoff. node_mask tells which workers sit on a node so a
+     * scheduler can look for a local one first.
+     */
+    uint64_t            idle_mask[LT_COMPUTE_MASK_WORDS];
+    uint64_t            node_mask[LT_MAX_NUMA_NODES][LT_COMPUTE_MASK_WORDS];
+
+    struct lthread_q    queue;
+    struct lthread_compute_task_q task_queue;
+    pthread_mutex_t     queue_mutex;
+    size_t              overflow;           /* items in the queues above */
+
+    size_t              queued;
+    size_t              queued_max;
+    uint64_t            submitted;
+    uint64_t            rejected;
+    uint64_t            scaled_up;
+    uint64_t            scaled_down;
+    uint64_t            wait_total;
+    uint64_t            wait_max;
+
+    /* cpus the workers may run on, protected by mutex */
+    cpu_set_t           cpus;
+    int                 cpus_set;
+
+    LIST_ENTRY(lthread_compute_pool) next;
+};
+
+static struct lthread_compute_pool compute_default_pool = {
+    .name = "default",
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .idle_timeout = LT_COMPUTE_IDLE_TIMEOUT,
+    .scale_queued = 1,
+    .queue = TAILQ_HEAD_INITIALIZER(compute_default_pool.queue),
+    .task_queue = TAILQ_HEAD_INITIALIZER(compute_default_pool.task_queue),
+    .queue_mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* named pools, they live as long as the process */
+static LIST_HEAD(, lthread_compute_pool) compute_pools =
+    LIST_HEAD_INITIALIZER(compute_pools);
+static pthread_mutex_t compute_pools_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static void* _lthread_compute_run(void *arg);
 static void _lthread_compute_resume(struct lthread *lt);
-static struct lthread_compute_sched* _lthread_compute_sched_create(void);
-static void _lthread_compute_sched_free(
+static struct lthread_compute_sched* _lthread_compute_sched_create(
+    struct lthread_compute_pool *pool, size_t index, int node);
+static int _lthread_compute_sched_start(
     struct lthread_compute_sched *compute_sched);
+static int _lthread_compute_pool_start(struct lthread_compute_pool *pool);
+static void _lthread_compute_wakeup_any(struct lthread_compute_pool *pool);
+static inline size_t _lthread_compute_min(struct lthread_compute_pool *pool);
+
+/*
+ * Bounded multi-producer multi-consumer ring. Each cell carries a sequence
+ * number telling producers and consumers whose turn it is, so pushing and
+ * popping is a single CAS on the respective position.
+ */
+struct lthread_compute_cell {
+    size_t              seq;
+    struct lthread_compute_item item;
+};
+
+struct lthread_compute_ring {
+    struct lthread_compute_cell cells[LT_COMPUTE_RING_SIZE];
+    size_t              push_pos __attribute__((aligned(64)));
+    size_t              pop_pos __attribute__((aligned(64)));
+};
 
 struct lthread_compute_sched {
     struct cpu_ctx      ctx;
-    struct lthread_q    lthreads;
     struct lthread      *current_lthread;
-    pthread_mutex_t     run_mutex;
+    struct lthread_compute_ring ring;                       /* lthreads to run */
+    pthread_mutex_t     run_mutex;                          /* protects idle sleep */
     pthread_cond_t      run_mutex_cond;
-    pthread_mutex_t     lthreads_mutex;
-    LIST_ENTRY(lthread_compute_sched)    compute_next;
-    enum lthread_compute_st compute_st;                    // [lmy] compute sched的状态：空闲或忙碌
+    int                 idle;                               /* sleeping on run_mutex_cond */
+    int                 retired;                            /* slot cut off by resizing */
+    int                 running;                            /* pthread is alive */
+    size_t              index;                              /* slot and idle mask bit */
+    struct lthread_compute_pool *pool;
+    pthread_t           pthread;
+    int                 numa_node;                          /* -1 if not pinned to a node */
 };
 
-// [lmy]获取一个compute sched或者直接创建一个载有compute sched的新线程，
-// 将当前lthread交由compute sched运行，并让出当前lthread占有的线程。
-// NOTE：此即如何将一个lthread扔到另外一个线程上执行，只需把lthread信息复制到另一个线程的调度器上就可以了
-int
-lthread_compute_begin(void)
+static void
+_lthread_compute_ring_init(struct lthread_compute_ring *ring)
 {
-    struct lthread_sched *sched = lthread_get_sched();       
-    struct lthread_compute_sched *compute_sched = NULL, *tmp = NULL;
-    struct lthread *lt = sched->current_lthread;            // [lmy] 获取执行代码自身的lthread信息
+    size_t i = 0;
 
-    /* search for an empty compute_scheduler */
-    assert(pthread_mutex_lock(&sched_mutex) == 0);
-    LIST_FOREACH(tmp, &compute_scheds, compute_next) {    // [lmy] 宏定义的for循环
-        if (tmp->compute_st == LT_COMPUTE_FREE) {
-            compute_sched = tmp;
-            break;
+    for (i = 0; i < LT_COMPUTE_RING_SIZE; i++)
+        ring->cells[i].seq = i;
+    ring->push_pos = 0;
+    ring->pop_pos = 0;
+}
+
+/* returns -1 if the ring is full */
+static int
+_lthread_compute_ring_push(struct lthread_compute_ring *ring,
+    const struct lthread_compute_item *item)
+{
+    struct lthread_compute_cell *cell = NULL;
+    size_t pos = __atomic_load_n(&ring->push_pos, __ATOMIC_RELAXED);
+    intptr_t diff = 0;
+
+    while (1) {
+        cell = &ring->cells[pos & (LT_COMPUTE_RING_SIZE - 1)];
+        diff = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) -
+            (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->push_pos, &pos, pos + 1,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return (-1);
+        } else {
+            pos = __atomic_load_n(&ring->push_pos, __ATOMIC_RELAXED);
         }
     }
 
-    /* create schedule if there is no scheduler available */
-    if (compute_sched == NULL) {
-        if ((compute_sched = _lthread_compute_sched_create()) == NULL) {  // [lmy] 若在这里创建了一个载有compute sched的pthread，它马上就会进入调度循环
-            /* we failed to create a scheduler. Use the first scheduler
-             * in the list, otherwise return failure.
-             */
-            compute_sched = LIST_FIRST(&compute_scheds);
-            if (compute_sched == NULL) {
-                assert(pthread_mutex_unlock(&sched_mutex) == 0);
-                return -1;
-            }
+    cell->item = *item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    return (0);
+}
+
+/* returns -1 if the ring is empty */
+static int
+_lthread_compute_ring_pop(struct lthread_compute_ring *ring,
+    struct lthread_compute_item *item)
+{
+    struct lthread_compute_cell *cell = NULL;
+    size_t pos = __atomic_load_n(&ring->pop_pos, __ATOMIC_RELAXED);
+    intptr_t diff = 0;
+
+    while (1) {
+        cell = &ring->cells[pos & (LT_COMPUTE_RING_SIZE - 1)];
+        diff = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) -
+            (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->pop_pos, &pos, pos + 1,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            return (-1);
         } else {
-            LIST_INSERT_HEAD(&compute_scheds, compute_sched, compute_next);     // [lmy] 若创建成功则插入到compute sched链表中
+            pos = __atomic_load_n(&ring->pop_pos, __ATOMIC_RELAXED);
         }
     }
 
-    lt->compute_sched = compute_sched;      // [lmy] 注册自身的compute sched信息
+    *item = cell->item;
+    __atomic_store_n(&cell->seq, pos + LT_COMPUTE_RING_SIZE,
+        __ATOMIC_RELEASE);
+
+    return (0);
+}
+
+/* a pool always keeps one worker so items can be pushed somewhere */
+static inline size_t
+_lthread_compute_min(struct lthread_compute_pool *pool)
+{
+    return (pool->min_workers > 0 ? pool->min_workers : 1);
+}
+
+/* starts the pool on first use, returns -1 if there are no workers */
+static int
+_lthread_compute_ensure(struct lthread_compute_pool *pool)
+{
+    int ret = 0;
 
-    lt->state |= BIT(LT_ST_PENDING_RUNCOMPUTE);     
-    assert(pthread_mutex_lock(&lt->compute_sched->lthreads_mutex) == 0);
-    TAILQ_INSERT_TAIL(&lt->compute_sched->lthreads, lt, compute_next);   // [lmy]把当前lthread的地址插入compute sched的队列尾部，但PENDING_RUNCOMPUTE状态还不能马上被执行
-    assert(pthread_mutex_unlock(&lt->compute_sched->lthreads_mutex) == 0);
+    if (__atomic_load_n(&pool->workers, __ATOMIC_ACQUIRE) != 0)
+        return (0);
 
-    assert(pthread_mutex_unlock(&sched_mutex) == 0);
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    if (_lthread_compute_pool_start(pool) == -1 && pool->workers == 0)
+        ret = -1;
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+
+    return (ret);
+}
+
+/* fails with EAGAIN if pool has as many items queued as it may */
+static int
+_lthread_compute_admit(struct lthread_compute_pool *pool)
+{
+    if (pool->max_queued == 0 ||
+        __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) < pool->max_queued)
+        return (0);
+
+    __atomic_add_fetch(&pool->rejected, 1, __ATOMIC_RELAXED);
+    errno = EAGAIN;
+
+    return (-1);
+}
+
+// [lmy]确保compute pool已经启动，然后让出当前lthread占有的线程，由原调度器在_lthread_compute_add中把它交给一个worker。
+// NOTE：此即如何将一个lthread扔到另外一个线程上执行，只需把lthread信息复制到另一个线程的调度器上就可以了
+int
+lthread_compute_begin(void)
+{
+    return (lthread_compute_begin_pool(&compute_default_pool));
+}
+
+int
+lthread_compute_begin_pool(struct lthread_compute_pool *pool)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt = sched->current_lthread;            // [lmy] 获取执行代码自身的lthread信息
+
+    if (_lthread_compute_ensure(pool) == -1 ||
+        _lthread_compute_admit(pool) == -1)
+        return -1;
+
+    lt->compute_sched = NULL;
+    lt->compute_pool = pool;
+    lt->state |= BIT(LT_ST_PENDING_RUNCOMPUTE);
+    __atomic_add_fetch(&pool->submitted, 1, __ATOMIC_RELAXED);
 
     /* yield function in scheduler to allow other lthreads to run while
      * this lthread runs in a pthread for expensive computations.
      */
     _switch(&lt->sched->ctx, &lt->ctx);     // [lmy] 让出当前占用的线程，切换到调度器会继续执行lhread_resume剩下的指令，
-                                            // 包括转移PENDING_RUNCOMPUTE状态为LT_ST_RUNCOMPUTE，一旦修改compute sched就可以执行这个lthread了
+                                            // 由_lthread_compute_add把lthread交给compute worker
 
     return (0);
 }
@@ -129,67 +363,954 @@ lthread_compute_end(void)
     _switch(&compute_sched->ctx, &lt->ctx);
 }
 
+static inline uint64_t
+_lthread_compute_bit(struct lthread_compute_sched *compute_sched)
+{
+    return (1ULL << (compute_sched->index % 64));
+}
+
+static inline uint64_t *
+_lthread_compute_idle_word(struct lthread_compute_sched *compute_sched)
+{
+    return (&compute_sched->pool->idle_mask[compute_sched->index / 64]);
+}
+
+/*
+ * Claims an idle worker for an lthread from a scheduler on `node`, local
+ * workers first. Returns NULL if every worker is busy.
+ */
+static struct lthread_compute_sched *
+_lthread_compute_claim(struct lthread_compute_pool *pool, int node)
+{
+    uint64_t bits = 0, bit = 0;
+    int local = 0;
+    int w = 0;
+
+    for (local = (node >= 0 && node < LT_MAX_NUMA_NODES); local >= 0;
+        local--) {
+        for (w = 0; w < LT_COMPUTE_MASK_WORDS; w++) {
+            bits = __atomic_load_n(&pool->idle_mask[w], __ATOMIC_RELAXED);
+            if (local)
+                bits &= __atomic_load_n(&pool->node_mask[node][w],
+                    __ATOMIC_RELAXED);
+            while (bits) {
+                bit = 1ULL << __builtin_ctzll(bits);
+                if (__atomic_fetch_and(&pool->idle_mask[w], ~bit,
+                    __ATOMIC_SEQ_CST) & bit)
+                    return (pool->slots[w * 64 + __builtin_ctzll(bit)]);
+                bits &= ~bit;
+            }
+        }
+    }
+
+    return (NULL);
+}
+
+/* moves a worker between node masks, node may be -1 */
+static void
+_lthread_compute_set_node(struct lthread_compute_sched *compute_sched,
+    int node)
+{
+    struct lthread_compute_pool *pool = compute_sched->pool;
+    size_t w = compute_sched->index / 64;
+    uint64_t bit = _lthread_compute_bit(compute_sched);
+
+    if (compute_sched->numa_node >= 0 &&
+        compute_sched->numa_node < LT_MAX_NUMA_NODES)
+        __atomic_fetch_and(&pool->node_mask[compute_sched->numa_node][w],
+            ~bit, __ATOMIC_RELAXED);
+    compute_sched->numa_node = node;
+    if (node >= 0 && node < LT_MAX_NUMA_NODES)
+        __atomic_fetch_or(&pool->node_mask[node][w], bit, __ATOMIC_RELAXED);
+}
+
+static void
+_lthread_compute_wakeup(struct lthread_compute_sched *compute_sched)
+{
+    assert(pthread_mutex_lock(&compute_sched->run_mutex) == 0);
+    assert(pthread_cond_signal(&compute_sched->run_mutex_cond) == 0);
+    assert(pthread_mutex_unlock(&compute_sched->run_mutex) == 0);
+}
+
+/* wakes up an idle worker if there is one */
+static void
+_lthread_compute_wakeup_any(struct lthread_compute_pool *pool)
+{
+    struct lthread_compute_sched *compute_sched =
+        _lthread_compute_claim(pool, -1);
+
+    if (compute_sched != NULL)
+        _lthread_compute_wakeup(compute_sched);
+}
+
+static void
+_lthread_compute_queued(struct lthread_compute_pool *pool)
+{
+    size_t queued = __atomic_add_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+    size_t max = __atomic_load_n(&pool->queued_max, __ATOMIC_RELAXED);
+
+    while (queued > max && !__atomic_compare_exchange_n(&pool->queued_max,
+        &max, queued, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * Adds a worker if the pool is backed up: more than scale_queued items
+ * waiting per worker and room below max_workers. Whoever is already
+ * resizing the pool takes care of it otherwise.
+ */
+static void
+_lthread_compute_grow(struct lthread_compute_pool *pool)
+{
+    size_t workers = __atomic_load_n(&pool->workers, __ATOMIC_ACQUIRE);
+
+    if (pool->scale_queued == 0 || workers >= pool->max_workers ||
+        __atomic_load_n(&pool->queued, __ATOMIC_RELAXED) <=
+        workers * pool->scale_queued)
+        return;
+
+    if (pthread_mutex_trylock(&pool->mutex) != 0)
+        return;
+    if (pool->workers == pool->size && pool->size < pool->max_workers) {
+        pool->size++;
+        if (_lthread_compute_pool_start(pool) == 0)
+            pool->scaled_up++;
+    }
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+}
+
+/*
+ * Retires a worker that idled for idle_timeout, as long as it's the last
+ * live slot and the pool stays above min_workers, so slots stay dense.
+ */
+static void
+_lthread_compute_shrink(struct lthread_compute_sched *compute_sched)
+{
+    struct lthread_compute_pool *pool = compute_sched->pool;
+
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    if (compute_sched->index + 1 == pool->workers &&
+        pool->workers > _lthread_compute_min(pool)) {
+        pool->size = pool->workers - 1;
+        _lthread_compute_pool_start(pool);
+        pool->scaled_down++;
+    }
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+}
+
+/*
+ * Hands an item from a scheduler on `node` to a worker: an idle one if we
+ * can claim it, else it's queued behind a busy one.
+ */
+static void
+_lthread_compute_push(struct lthread_compute_pool *pool,
+    const struct lthread_compute_item *item, int node)
+{
+    struct lthread_compute_sched *compute_sched = NULL;
+    size_t n = 0;
+    int claimed = 0;
+
+    _lthread_compute_queued(pool);
+
+    if ((compute_sched = _lthread_compute_claim(pool, node)) == NULL) {
+        _lthread_compute_grow(pool);
+        n = __atomic_load_n(&pool->workers, __ATOMIC_ACQUIRE);
+        compute_sched = pool->slots[
+            __atomic_fetch_add(&pool->rr, 1, __ATOMIC_RELAXED) % n];
+    } else {
+        claimed = 1;
+    }
+
+    if (_lthread_compute_ring_push(&compute_sched->ring, item) == -1) {
+        assert(pthread_mutex_lock(&pool->queue_mutex) == 0);
+        if (item->lt != NULL)
+            TAILQ_INSERT_TAIL(&pool->queue, item->lt, compute_next);
+        else
+            TAILQ_INSERT_TAIL(&pool->task_queue, item->task, next);
+        __atomic_add_fetch(&pool->overflow, 1, __ATOMIC_SEQ_CST);
+        assert(pthread_mutex_unlock(&pool->queue_mutex) == 0);
+        if (claimed)
+            _lthread_compute_wakeup(compute_sched);
+        else
+            _lthread_compute_wakeup_any(pool);
+        return;
+    }
+
+    if (claimed) {
+        _lthread_compute_wakeup(compute_sched);
+        return;
+    }
+
+    /*
+     * the worker was busy when we looked. pairs with the fence in
+     * _lthread_compute_run(): either the worker sees the item before it
+     * sleeps or we see it sleeping. a retired worker won't look again, get
+     * another one to steal it.
+     */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&compute_sched->idle, __ATOMIC_RELAXED))
+        _lthread_compute_wakeup(compute_sched);
+    else if (__atomic_load_n(&compute_sched->retired, __ATOMIC_RELAXED))
+        _lthread_compute_wakeup_any(pool);
+}
+
 // [lmy] 这个函数被将要转移到compute sched上执行的那个lthread的原所属sched执行，正式确认lthread的转移
 void
 _lthread_compute_add(struct lthread *lt)
 {
+    struct lthread_compute_item item = {lt, NULL};
 
     LIST_INSERT_HEAD(&lt->sched->busy, lt, busy_next);  // [lmy] 将lthread注册到原sched的busy链表上
+
     /*
-     * lthread is in scheduler list at this point. lock mutex to change
-     * state since the state is checked in scheduler as well.
+     * we are off the lthread's stack at this point, so it's safe for a
+     * worker to pick it up as soon as it's pushed.
      */
-    assert(pthread_mutex_lock(&lt->compute_sched->lthreads_mutex) == 0);
-    lt->state &= CLEARBIT(LT_ST_PENDING_RUNCOMPUTE);    // [lmy] PENDING_RUNCOMPUTE状态还不能被compute sched执行
-    lt->state |= BIT(LT_ST_RUNCOMPUTE);                 // [lmy] 只有lthread原所属sched进一步把lthread的状态从PENDING_RUNCOMPUTE转移至RUNCOMPUTE，compute sched才可以执行它
-    assert(pthread_mutex_unlock(&lt->compute_sched->lthreads_mutex) == 0);
+    lt->state &= CLEARBIT(LT_ST_PENDING_RUNCOMPUTE);
+    lt->state |= BIT(LT_ST_RUNCOMPUTE);
+    lt->compute_queued = _lthread_usec_now();
+    _lthread_compute_push(lt->compute_pool, &item, lt->sched->numa_node);
+}
+
+static void
+_lthread_compute_spawn(struct lthread_compute_group *group,
+    struct lthread_compute_task *task)
+{
+    struct lthread_compute_item item = {NULL, task};
+    struct lthread_sched *sched = lthread_get_sched();
+
+    task->group = group;
+    task->queued = _lthread_usec_now();
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&group->pool->submitted, 1, __ATOMIC_RELAXED);
+    _lthread_compute_push(group->pool, &item, sched ? sched->numa_node : -1);
+}
+
+/* called by a worker after running a task */
+static void
+_lthread_compute_task_done(struct lthread_compute_task *task)
+{
+    struct lthread_compute_group *group = task->group;
+    struct lthread *lt = NULL;
+
+    if (!task->embedded)
+        free(task);
+
+    /* detached, see _lthread_compute_async() */
+    if (group == NULL)
+        return;
+
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    /* we dropped the waiter's reference, it is parked and ours to wake */
+    lt = group->waiter;
+    if (lt == NULL) {
+        assert(pthread_mutex_lock(&group->mutex) == 0);
+        group->done = 1;
+        assert(pthread_cond_signal(&group->cond) == 0);
+        assert(pthread_mutex_unlock(&group->mutex) == 0);
+        return;
+    }
+    assert(pthread_mutex_lock(&lt->sched->defer_mutex) == 0);
+    TAILQ_INSERT_TAIL(&lt->sched->defer, lt, defer_next);
+    assert(pthread_mutex_unlock(&lt->sched->defer_mutex) == 0);
+    _lthread_poller_ev_trigger(lt->sched);
+}
+
+/*
+ * Runs fn(arg) on pool (the default pool if NULL) with nobody waiting on it.
+ * fn is responsible for reporting its own completion.
+ */
+int
+_lthread_compute_async(struct lthread_compute_pool *pool,
+    lthread_compute_fn fn, void *arg)
+{
+    struct lthread_compute_item item = {NULL, NULL};
+    struct lthread_sched *sched = lthread_get_sched();
+
+    if (pool == NULL)
+        pool = &compute_default_pool;
+    if (_lthread_compute_ensure(pool) == -1 ||
+        _lthread_compute_admit(pool) == -1)
+        return (-1);
+
+    if ((item.task = calloc(1, sizeof(struct lthread_compute_task))) == NULL)
+        return (-1);
+    item.task->fn = fn;
+    item.task->arg = arg;
+    item.task->queued = _lthread_usec_now();
+    __atomic_add_fetch(&pool->submitted, 1, __ATOMIC_RELAXED);
+    _lthread_compute_push(pool, &item, sched ? sched->numa_node : -1);
 
-    /* wakeup pthread if it was sleeping */
-    assert(pthread_mutex_lock(&lt->compute_sched->run_mutex) == 0);
-    assert(pthread_cond_signal(&lt->compute_sched->run_mutex_cond) == 0);   // [lmy] 若compute sched没有任务，它会通过pthread_cond_timedwait等待60秒，
-                                                            // 这里创建了任务后及时唤醒它，防止其exit（对应的cond_timedwait在_lthread_compute_run）
-    assert(pthread_mutex_unlock(&lt->compute_sched->run_mutex) == 0);
+    return (0);
+}
 
+static void
+_lthread_compute_group_init(struct lthread_compute_group *group,
+    struct lthread_compute_pool *pool)
+{
+    group->pending = 1;
+    group->waiter = NULL;
+    group->pool = pool;
+    group->done = 0;
+    assert(pthread_mutex_init(&group->mutex, NULL) == 0);
+    assert(pthread_cond_init(&group->cond, NULL) == 0);
 }
 
 static void
-_lthread_compute_sched_free(struct lthread_compute_sched *compute_sched)
+_lthread_compute_group_destroy(struct lthread_compute_group *group)
 {
-    assert(pthread_mutex_destroy(&compute_sched->run_mutex) == 0);
-    assert(pthread_mutex_destroy(&compute_sched->lthreads_mutex) == 0);
-    assert(pthread_cond_destroy(&compute_sched->run_mutex_cond) == 0);
-    free(compute_sched);
+    assert(pthread_mutex_destroy(&group->mutex) == 0);
+    assert(pthread_cond_destroy(&group->cond) == 0);
 }
 
-// [lmy]在进程的堆上创建一个compute sched的结构体，创建一个pthread，并为其绑定compute sched的调度循环函数
+int
+lthread_compute_group_create(struct lthread_compute_group **group)
+{
+    return (lthread_compute_group_create_pool(group, &compute_default_pool));
+}
+
+/* tasks spawned in the group run on pool */
+int
+lthread_compute_group_create_pool(struct lthread_compute_group **group,
+    struct lthread_compute_pool *pool)
+{
+    if (_lthread_compute_ensure(pool) == -1)
+        return (-1);
+
+    if ((*group = calloc(1, sizeof(struct lthread_compute_group))) == NULL)
+        return (-1);
+    _lthread_compute_group_init(*group, pool);
+
+    return (0);
+}
+
+/* runs fn(arg) on a compute worker as part of group */
+int
+lthread_compute_group_spawn(struct lthread_compute_group *group,
+    lthread_compute_fn fn, void *arg)
+{
+    struct lthread_compute_task *task = NULL;
+
+    if (_lthread_compute_admit(group->pool) == -1)
+        return (-1);
+
+    if ((task = calloc(1, sizeof(struct lthread_compute_task))) == NULL)
+        return (-1);
+
+    task->fn = fn;
+    task->arg = arg;
+    _lthread_compute_spawn(group, task);
+
+    return (0);
+}
+
+/*
+ * Waits for every task spawned in group so far. The calling lthread parks
+ * and its scheduler keeps running others meanwhile. The group can be reused
+ * afterwards.
+ */
+int
+lthread_compute_group_wait(struct lthread_compute_group *group)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt = sched ? sched->current_lthread : NULL;
+
+    if (lt == NULL) {
+        /* not in an lthread, nothing to park, block until the last task */
+        if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) != 0) {
+            assert(pthread_mutex_lock(&group->mutex) == 0);
+            while (!group->done)
+                assert(pthread_cond_wait(&group->cond, &group->mutex) == 0);
+            assert(pthread_mutex_unlock(&group->mutex) == 0);
+        }
+        group->done = 0;
+        group->pending = 1;
+    } else {
+        group->waiter = lt;
+        lt->state |= BIT(LT_ST_WAIT_COMPUTE);
+        LIST_INSERT_HEAD(&sched->busy, lt, busy_next);
+        if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0)
+            LIST_REMOVE(lt, busy_next);
+        else
+            _lthread_yield(lt);
+        lt->state &= CLEARBIT(LT_ST_WAIT_COMPUTE);
+        group->waiter = NULL;
+        group->pending = 1;
+    }
+
+    return (0);
+}
+
+void
+lthread_compute_group_free(struct lthread_compute_group *group)
+{
+    _lthread_compute_group_destroy(group);
+    free(group);
+}
+
+struct lthread_compute_call {
+    struct lthread_compute_task task;
+    void                *(*fn)(void *);
+    void                *arg;
+    void                *result;
+    int                 err;
+};
+
+static void
+_lthread_compute_call_run(void *arg)
+{
+    struct lthread_compute_call *call = arg;
+
+    errno = 0;
+    call->result = call->fn(call->arg);
+    call->err = errno;
+}
+
+/*
+ * Runs fn(arg) on a compute worker's own stack and parks the calling lthread
+ * until it returns. Unlike compute_begin/end the lthread itself never leaves
+ * its scheduler, fn sees the worker's thread-local state and errno is carried
+ * back.
+ */
+int
+lthread_compute_call(void *(*fn)(void *), void *arg, void **result)
+{
+    return (lthread_compute_call_pool(&compute_default_pool, fn, arg,
+        result));
+}
+
+int
+lthread_compute_call_pool(struct lthread_compute_pool *pool,
+    void *(*fn)(void *), void *arg, void **result)
+{
+    struct lthread_compute_group group;
+    struct lthread_compute_call call;
+
+    if (_lthread_compute_ensure(pool) == -1 ||
+        _lthread_compute_admit(pool) == -1)
+        return (-1);
+
+    memset(&call, 0, sizeof(call));
+    call.fn = fn;
+    call.arg = arg;
+    call.task.fn = _lthread_compute_call_run;
+    call.task.arg = &call;
+    call.task.embedded = 1;
+    _lthread_compute_group_init(&group, pool);
+    _lthread_compute_spawn(&group, &call.task);
+    lthread_compute_group_wait(&group);
+    _lthread_compute_group_destroy(&group);
+
+    if (result != NULL)
+        *result = call.result;
+    errno = call.err;
+
+    return (0);
+}
+
+struct lthread_compute_chunk {
+    struct lthread_compute_task task;
+    lthread_compute_range_fn fn;
+    void                *ctx;
+    size_t              begin;
+    size_t              end;
+};
+
+static void
+_lthread_compute_chunk_run(void *arg)
+{
+    struct lthread_compute_chunk *chunk = arg;
+
+    chunk->fn(chunk->begin, chunk->end, chunk->ctx);
+}
+
+/*
+ * Calls fn over [begin, end) split in chunks of grain items spread on the
+ * compute workers and parks the calling lthread until all chunks are done.
+ * A grain of 0 makes about four chunks per worker.
+ */
+int
+lthread_compute_parallel_for(size_t begin, size_t end, size_t grain,
+    lthread_compute_range_fn fn, void *ctx)
+{
+    return (lthread_compute_parallel_for_pool(&compute_default_pool, begin,
+        end, grain, fn, ctx));
+}
+
+/*
+ * The queue limit of pool is only checked once up front, the chunks of an
+ * admitted loop are all queued.
+ */
+int
+lthread_compute_parallel_for_pool(struct lthread_compute_pool *pool,
+    size_t begin, size_t end, size_t grain, lthread_compute_range_fn fn,
+    void *ctx)
+{
+    struct lthread_compute_group group;
+    struct lthread_compute_chunk *chunks = NULL;
+    size_t nchunks = 0, i = 0, workers = 0;
+
+    if (begin >= end)
+        return (0);
+
+    if (_lthread_compute_ensure(pool) == -1 ||
+        _lthread_compute_admit(pool) == -1)
+        return (-1);
+
+    if (grain == 0) {
+        workers = __atomic_load_n(&pool->workers, __ATOMIC_ACQUIRE);
+        grain = (end - begin + workers * 4 - 1) / (workers * 4);
+    }
+    nchunks = (end - begin + grain - 1) / grain;
+
+    if ((chunks = calloc(nchunks, sizeof(struct lthread_compute_chunk))) ==
+        NULL)
+        return (-1);
+
+    _lthread_compute_group_init(&group, pool);
+    for (i = 0; i < nchunks; i++) {
+        chunks[i].fn = fn;
+        chunks[i].ctx = ctx;
+        chunks[i].begin = begin + i * grain;
+        chunks[i].end = (end - chunks[i].begin > grain) ?
+            chunks[i].begin + grain : end;
+        chunks[i].task.fn = _lthread_compute_chunk_run;
+        chunks[i].task.arg = &chunks[i];
+        chunks[i].task.embedded = 1;
+        _lthread_compute_spawn(&group, &chunks[i].task);
+    }
+
+    lthread_compute_group_wait(&group);
+    _lthread_compute_group_destroy(&group);
+    free(chunks);
+
+    return (0);
+}
+
+/*
+ * Picks the cpus a compute pthread serving a scheduler on `node` runs on:
+ * the configured compute cpus local to node, all configured compute cpus if
+ * none of them are local, or every cpu of node if nothing was configured.
+ * Returns the node the resulting set is confined to or -1.
+ */
+static int
+_lthread_compute_cpus(struct lthread_compute_pool *pool, int node,
+    cpu_set_t *set)
+{
+    cpu_set_t node_cpus;
+
+    if (node != -1)
+        _lthread_node_cpuset(node, &node_cpus);
+
+    if (pool->cpus_set) {
+        *set = pool->cpus;
+        if (node != -1) {
+            CPU_AND(&node_cpus, &node_cpus, &pool->cpus);
+            if (CPU_COUNT(&node_cpus) != 0)
+                *set = node_cpus;
+        }
+        return (_lthread_cpuset_node(set));
+    }
+
+    if (node != -1 && CPU_COUNT(&node_cpus) != 0) {
+        *set = node_cpus;
+        return (node);
+    }
+
+    return (-1);
+}
+
+/*
+ * Returns the cpus the pool is spread over: the configured compute cpus or
+ * whatever the process may run on.
+ */
+static void
+_lthread_compute_pool_cpus(struct lthread_compute_pool *pool, cpu_set_t *set)
+{
+    if (pool->cpus_set) {
+        *set = pool->cpus;
+        return;
+    }
+
+    CPU_ZERO(set);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), set) != 0 ||
+        CPU_COUNT(set) == 0) {
+        CPU_ZERO(set);
+    }
+}
+
+/*
+ * Returns the node the n-th worker of the pool belongs to. Workers are dealt
+ * round robin over the pool cpus so every node gets its share.
+ */
+static int
+_lthread_compute_worker_node(struct lthread_compute_pool *pool, size_t n)
+{
+    cpu_set_t set;
+    int count = 0;
+    int cpu = 0;
+
+    _lthread_compute_pool_cpus(pool, &set);
+    if ((count = CPU_COUNT(&set)) == 0)
+        return (-1);
+
+    n %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set))
+            continue;
+        if (n-- == 0)
+            return (_lthread_cpu_node(cpu));
+    }
+
+    return (-1);
+}
+
+/*
+ * Brings the number of live workers to pool->size, kept between min_workers
+ * (at least one) and max_workers, which defaults to the number of cpus we
+ * can run on.
+ * Retired slots are brought back before new ones are created; workers cut
+ * off by shrinking exit once their ring is empty. Returns -1 if a worker
+ * couldn't be started.
+ * Must be called with pool->mutex held.
+ */
+static int
+_lthread_compute_pool_start(struct lthread_compute_pool *pool)
+{
+    struct lthread_compute_sched *compute_sched = NULL;
+    cpu_set_t set;
+    long ncpus = 0;
+    size_t i = 0;
+    int ret = 0;
+
+    /* an unsized pool starts with one worker and scales up to one per cpu */
+    if (pool->max_workers == 0) {
+        _lthread_compute_pool_cpus(pool, &set);
+        ncpus = CPU_COUNT(&set);
+        if (ncpus == 0)
+            ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        pool->max_workers = ncpus > 0 ? ncpus : 1;
+    }
+    if (pool->max_workers > LT_COMPUTE_MAX_WORKERS)
+        pool->max_workers = LT_COMPUTE_MAX_WORKERS;
+    if (pool->min_workers > pool->max_workers)
+        pool->min_workers = pool->max_workers;
+    if (pool->size < _lthread_compute_min(pool))
+        pool->size = _lthread_compute_min(pool);
+    if (pool->size > pool->max_workers)
+        pool->size = pool->max_workers;
+
+    /* retire the slots past the new size */
+    for (i = pool->size; i < pool->workers; i++) {
+        compute_sched = pool->slots[i];
+        assert(pthread_mutex_lock(&compute_sched->run_mutex) == 0);
+        __atomic_store_n(&compute_sched->retired, 1, __ATOMIC_SEQ_CST);
+        assert(pthread_cond_signal(&compute_sched->run_mutex_cond) == 0);
+        assert(pthread_mutex_unlock(&compute_sched->run_mutex) == 0);
+    }
+    if (pool->workers > pool->size)
+        __atomic_store_n(&pool->workers, pool->size,
+            __ATOMIC_RELEASE);
+
+    while (pool->workers < pool->size) {
+        i = pool->workers;
+        if (i == pool->nslots) {
+            compute_sched = _lthread_compute_sched_create(pool, i,
+                _lthread_compute_worker_node(pool, i));
+            if (compute_sched == NULL)
+                return (-1);
+            pool->slots[i] = compute_sched;
+            __atomic_store_n(&pool->nslots, i + 1, __ATOMIC_RELEASE);
+        } else {
+            compute_sched = pool->slots[i];
+        }
+
+        /* a retired worker that hasn't exited yet just carries on */
+        assert(pthread_mutex_lock(&compute_sched->run_mutex) == 0);
+        __atomic_store_n(&compute_sched->retired, 0, __ATOMIC_SEQ_CST);
+        ret = compute_sched->running ? 0 :
+            _lthread_compute_sched_start(compute_sched);
+        assert(pthread_mutex_unlock(&compute_sched->run_mutex) == 0);
+        if (ret != 0)
+            return (-1);
+
+        __atomic_store_n(&pool->workers, i + 1, __ATOMIC_RELEASE);
+    }
+
+    return (0);
+}
+
+// [lmy]在进程的堆上创建一个compute sched的结构体，之后由_lthread_compute_sched_start为其创建pthread
 // 创建成功返回compute sched的地址，失败返回NULL
 static struct lthread_compute_sched*
-_lthread_compute_sched_create(void)
+_lthread_compute_sched_create(struct lthread_compute_pool *pool, size_t index,
+    int node)
 {
-    struct lthread_compute_sched *compute_sched = NULL;     
-    pthread_t pthread;
+    struct lthread_compute_sched *compute_sched = NULL;
 
-    if ((compute_sched = calloc(1,                  
+    if ((compute_sched = calloc(1,
         sizeof(struct lthread_compute_sched))) == NULL)     // [lmy]compute sched的信息位于进程的堆中
         return NULL;
 
     if (pthread_mutex_init(&compute_sched->run_mutex, NULL) != 0 ||
-        pthread_mutex_init(&compute_sched->lthreads_mutex, NULL) != 0 ||
         pthread_cond_init(&compute_sched->run_mutex_cond, NULL) != 0) {
         free(compute_sched);
         return NULL;
     }
 
-    if (pthread_create(&pthread,
-        NULL, _lthread_compute_run, compute_sched) != 0) {
-        _lthread_compute_sched_free(compute_sched);
-        return NULL;
+    _lthread_compute_ring_init(&compute_sched->ring);
+    compute_sched->index = index;
+    compute_sched->pool = pool;
+    compute_sched->numa_node = -1;
+    _lthread_compute_set_node(compute_sched, node);
+
+    return compute_sched;
+}
+
+/*
+ * Starts the pthread of a worker slot, pinned according to its node.
+ * Must be called with the worker's run_mutex held.
+ */
+static int
+_lthread_compute_sched_start(struct lthread_compute_sched *compute_sched)
+{
+    struct lthread_compute_pool *pool = compute_sched->pool;
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    int ret = 0;
+
+    assert(pthread_attr_init(&attr) == 0);
+    _lthread_compute_set_node(compute_sched,
+        _lthread_compute_cpus(pool, compute_sched->numa_node, &cpus));
+    if (compute_sched->numa_node != -1 || pool->cpus_set)
+        assert(pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t),
+            &cpus) == 0);
+
+    ret = pthread_create(&compute_sched->pthread,
+        &attr, _lthread_compute_run, compute_sched);
+    assert(pthread_attr_destroy(&attr) == 0);
+    if (ret != 0)
+        return (-1);
+    assert(pthread_detach(compute_sched->pthread) == 0);
+    compute_sched->running = 1;
+
+    return (0);
+}
+
+/*
+ * Sizes the default compute pool to nworkers pthreads. Workers are started
+ * right away so the first compute_begin() doesn't pay for it. 0 leaves the
+ * pool unsized: one worker, scaling up to one per cpu under load.
+ */
+int
+lthread_compute_set_workers(size_t nworkers)
+{
+    return (lthread_compute_pool_set_workers(&compute_default_pool,
+        nworkers));
+}
+
+int
+lthread_compute_pool_set_workers(struct lthread_compute_pool *pool,
+    size_t nworkers)
+{
+    int ret = 0;
+
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    pool->min_workers = nworkers;
+    pool->max_workers = nworkers;
+    pool->size = nworkers;
+    ret = _lthread_compute_pool_start(pool);
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+
+    return (ret);
+}
+
+/*
+ * Lets the pool scale between min_workers and max_workers (0 for one per
+ * cpu). min_workers are started right away and stay up; the pool adds a
+ * worker whenever more than scale_queued items wait per worker (0 never
+ * scales up) and a worker above min_workers that idles for idle_timeout
+ * msecs exits (0 keeps it).
+ */
+int
+lthread_compute_pool_configure(struct lthread_compute_pool *pool,
+    const struct lthread_compute_pool_config *config)
+{
+    int ret = 0;
+
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    pool->min_workers = config->min_workers;
+    pool->max_workers = config->max_workers;
+    pool->idle_timeout = config->idle_timeout;
+    pool->scale_queued = config->scale_queued;
+    if (pool->max_workers != 0 && pool->min_workers > pool->max_workers)
+        pool->min_workers = pool->max_workers;
+    pool->size = pool->workers;
+    ret = _lthread_compute_pool_start(pool);
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+
+    return (ret);
+}
+
+int
+lthread_compute_configure(const struct lthread_compute_pool_config *config)
+{
+    return (lthread_compute_pool_configure(&compute_default_pool, config));
+}
+
+void
+lthread_compute_stats(struct lthread_compute_stats *stats)
+{
+    lthread_compute_pool_stats(&compute_default_pool, stats);
+}
+
+void
+lthread_compute_pool_stats(struct lthread_compute_pool *pool,
+    struct lthread_compute_stats *stats)
+{
+    int w = 0;
+
+    stats->workers = __atomic_load_n(&pool->workers, __ATOMIC_ACQUIRE);
+    stats->idle_workers = 0;
+    for (w = 0; w < LT_COMPUTE_MASK_WORDS; w++)
+        stats->idle_workers += __builtin_popcountll(
+            __atomic_load_n(&pool->idle_mask[w], __ATOMIC_RELAXED));
+    stats->queued = __atomic_load_n(&pool->queued, __ATOMIC_RELAXED);
+    stats->queued_max = __atomic_load_n(&pool->queued_max, __ATOMIC_RELAXED);
+    stats->submitted = __atomic_load_n(&pool->submitted, __ATOMIC_RELAXED);
+    stats->rejected = __atomic_load_n(&pool->rejected, __ATOMIC_RELAXED);
+    stats->scaled_up = __atomic_load_n(&pool->scaled_up, __ATOMIC_RELAXED);
+    stats->scaled_down = __atomic_load_n(&pool->scaled_down,
+        __ATOMIC_RELAXED);
+    stats->wait_usecs_total = __atomic_load_n(&pool->wait_total,
+        __ATOMIC_RELAXED);
+    stats->wait_usecs_max = __atomic_load_n(&pool->wait_max,
+        __ATOMIC_RELAXED);
+}
+
+static int
+_lthread_compute_pool_set_cpus(struct lthread_compute_pool *pool,
+    const int *cpus, int ncpus)
+{
+    struct lthread_compute_sched *compute_sched = NULL;
+    cpu_set_t set;
+    size_t i = 0;
+
+    if (_lthread_cpus_to_set(cpus, ncpus, &set) == -1)
+        return (-1);
+
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    pool->cpus = set;
+    pool->cpus_set = 1;
+    for (i = 0; i < pool->nslots; i++) {
+        compute_sched = pool->slots[i];
+        assert(pthread_mutex_lock(&compute_sched->run_mutex) == 0);
+        _lthread_compute_set_node(compute_sched,
+            _lthread_compute_cpus(pool, compute_sched->numa_node, &set));
+        if (compute_sched->running)
+            pthread_setaffinity_np(compute_sched->pthread, sizeof(cpu_set_t),
+                &set);
+        assert(pthread_mutex_unlock(&compute_sched->run_mutex) == 0);
     }
-    assert(pthread_detach(pthread) == 0);
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
 
-    TAILQ_INIT(&compute_sched->lthreads);       // [lmy]初始化lthread队列为一个空队列
+    return (0);
+}
 
-    return compute_sched;
+/*
+ * Restricts compute pthreads of the default pool to `cpus`. Running compute
+ * pthreads are moved right away; new ones prefer the cpus local to the
+ * requesting scheduler.
+ */
+int
+lthread_compute_set_cpus(const int *cpus, int ncpus)
+{
+    return (_lthread_compute_pool_set_cpus(&compute_default_pool, cpus,
+        ncpus));
+}
+
+/* must be called with compute_pools_mutex held */
+static struct lthread_compute_pool *
+_lthread_compute_pool_lookup(const char *name)
+{
+    struct lthread_compute_pool *pool = NULL;
+
+    if (strcmp(name, compute_default_pool.name) == 0)
+        return (&compute_default_pool);
+
+    LIST_FOREACH(pool, &compute_pools, next)
+        if (strncmp(pool->name, name, sizeof(pool->name)) == 0)
+            break;
+
+    return (pool);
+}
+
+/*
+ * Creates a compute pool called name with nworkers pthreads (0 for one per
+ * cpu) that queues at most max_queued items (0 for no limit) before
+ * compute calls on it fail with EAGAIN. If cpus is given the workers only
+ * run there. The workers are started right away.
+ */
+int
+lthread_compute_pool_create(struct lthread_compute_pool **new_pool,
+    const char *name, size_t nworkers, size_t max_queued, const int *cpus,
+    int ncpus)
+{
+    struct lthread_compute_pool *pool = NULL;
+
+    assert(pthread_mutex_lock(&compute_pools_mutex) == 0);
+    if (_lthread_compute_pool_lookup(name) != NULL) {
+        assert(pthread_mutex_unlock(&compute_pools_mutex) == 0);
+        errno = EEXIST;
+        return (-1);
+    }
+
+    if ((pool = calloc(1, sizeof(struct lthread_compute_pool))) == NULL) {
+        assert(pthread_mutex_unlock(&compute_pools_mutex) == 0);
+        return (-1);
+    }
+
+    snprintf(pool->name, sizeof(pool->name), "%s", name);
+    assert(pthread_mutex_init(&pool->mutex, NULL) == 0);
+    assert(pthread_mutex_init(&pool->queue_mutex, NULL) == 0);
+    TAILQ_INIT(&pool->queue);
+    TAILQ_INIT(&pool->task_queue);
+    pool->max_queued = max_queued;
+    pool->idle_timeout = LT_COMPUTE_IDLE_TIMEOUT;
+    pool->scale_queued = 1;
+
+    if ((cpus != NULL &&
+        _lthread_compute_pool_set_cpus(pool, cpus, ncpus) == -1) ||
+        lthread_compute_pool_set_workers(pool, nworkers) == -1) {
+        /* workers that did start keep the pool alive, so don't free it */
+        if (pool->nslots == 0)
+            free(pool);
+        else
+            LIST_INSERT_HEAD(&compute_pools, pool, next);
+        assert(pthread_mutex_unlock(&compute_pools_mutex) == 0);
+        return (-1);
+    }
+
+    LIST_INSERT_HEAD(&compute_pools, pool, next);
+    assert(pthread_mutex_unlock(&compute_pools_mutex) == 0);
+    *new_pool = pool;
+
+    return (0);
+}
+
+/* returns the pool called name or NULL, "default" is the default pool */
+struct lthread_compute_pool *
+lthread_compute_pool_find(const char *name)
+{
+    struct lthread_compute_pool *pool = NULL;
+
+    assert(pthread_mutex_lock(&compute_pools_mutex) == 0);
+    pool = _lthread_compute_pool_lookup(name);
+    assert(pthread_mutex_unlock(&compute_pools_mutex) == 0);
+
+    return (pool);
 }
 
 // compute sched开始执行某一个lthread
@@ -206,92 +1327,172 @@ once_routine(void)
     assert(pthread_key_create(&compute_sched_key, NULL) == 0);
 }
 
-// computer sched的调度循环，参数arg是调度器
-static void*
-_lthread_compute_run(void *arg)
+/*
+ * Finds the next item for a worker: its own ring first, then the rings of
+ * workers on the same node, then everyone else's, then the overflow queues.
+ * Returns -1 if there is nothing to do.
+ */
+static int
+_lthread_compute_next(struct lthread_compute_sched *compute_sched,
+    struct lthread_compute_item *item)
 {
-    struct lthread_compute_sched *compute_sched = arg;      
-    struct lthread *lt = NULL;
-    struct timespec timeout;
-    int status = 0;
-    int ret = 0;
-    (void)ret; /* silence compiler */
+    struct lthread_compute_pool *pool = compute_sched->pool;
+    struct lthread_compute_sched *victim = NULL;
+    size_t n = __atomic_load_n(&pool->nslots, __ATOMIC_ACQUIRE);
+    size_t i = 0;
+    int local = 0;
 
-    assert(pthread_once(&key_once, once_routine) == 0);
-    assert(pthread_setspecific(compute_sched_key, arg) == 0);
+    if (_lthread_compute_ring_pop(&compute_sched->ring, item) == 0)
+        return (0);
+
+    for (local = 1; local >= 0; local--) {
+        for (i = 0; i < n; i++) {
+            victim = pool->slots[i];
+            if (victim == compute_sched ||
+                (victim->numa_node == compute_sched->numa_node) != local)
+                continue;
+            if (_lthread_compute_ring_pop(&victim->ring, item) == 0)
+                return (0);
+        }
+    }
 
-    while (1) { // 外循环用来判断是否需要exit，会调用一个等待
+    if (__atomic_load_n(&pool->overflow, __ATOMIC_SEQ_CST) == 0)
+        return (-1);
 
-        /* resume lthreads to run their computation or make a blocking call */
-        while (1) {     // [lmy] compute sched要干的活在这里
-            assert(pthread_mutex_lock(&compute_sched->lthreads_mutex) == 0);
+    item->lt = NULL;
+    item->task = NULL;
+    assert(pthread_mutex_lock(&pool->queue_mutex) == 0);
+    if ((item->lt = TAILQ_FIRST(&pool->queue)) != NULL)
+        TAILQ_REMOVE(&pool->queue, item->lt, compute_next);
+    else if ((item->task = TAILQ_FIRST(&pool->task_queue)) != NULL)
+        TAILQ_REMOVE(&pool->task_queue, item->task, next);
+    if (item->lt != NULL || item->task != NULL)
+        __atomic_sub_fetch(&pool->overflow, 1, __ATOMIC_SEQ_CST);
+    assert(pthread_mutex_unlock(&pool->queue_mutex) == 0);
 
-            /* we have no work to do, break and wait 60 secs then exit */
-            if (TAILQ_EMPTY(&compute_sched->lthreads)) {
-                assert(pthread_mutex_unlock(
-                    &compute_sched->lthreads_mutex) == 0);
-                break;
-            }
+    return (item->lt != NULL || item->task != NULL ? 0 : -1);
+}
 
-            lt = TAILQ_FIRST(&compute_sched->lthreads);
-            if (lt->state & BIT(LT_ST_PENDING_RUNCOMPUTE)) {
-                assert(pthread_mutex_unlock(
-                    &compute_sched->lthreads_mutex) == 0);
-                continue;
-            }
+/* accounts for the time an item queued at `queued` waited for a worker */
+static void
+_lthread_compute_dequeued(struct lthread_compute_pool *pool, uint64_t queued)
+{
+    uint64_t wait = _lthread_diff_usecs(queued, _lthread_usec_now());
+    uint64_t max = __atomic_load_n(&pool->wait_max, __ATOMIC_RELAXED);
+
+    __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->wait_total, wait, __ATOMIC_RELAXED);
+    while (wait > max && !__atomic_compare_exchange_n(&pool->wait_max,
+        &max, wait, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
 
-            TAILQ_REMOVE(&compute_sched->lthreads, lt, compute_next);   // 【直接从队列中移除，所以lthread一旦yield就不会再回来执行了？需要思考一下为什么作这样的设定……】
+/*
+ * Sleeps until a scheduler wakes us up. Workers above min_workers only wait
+ * for idle_timeout and return ETIMEDOUT so they can be retired.
+ * Must be called with run_mutex held.
+ */
+static int
+_lthread_compute_idle_wait(struct lthread_compute_sched *compute_sched)
+{
+    struct lthread_compute_pool *pool = compute_sched->pool;
+    struct timespec ts;
+    uint64_t timeout = pool->idle_timeout;
 
-            assert(pthread_mutex_unlock(&compute_sched->lthreads_mutex) == 0);
+    if (timeout == 0 || compute_sched->index < _lthread_compute_min(pool))
+        return (pthread_cond_wait(&compute_sched->run_mutex_cond,
+            &compute_sched->run_mutex));
 
-            compute_sched->current_lthread = lt;
-            compute_sched->compute_st = LT_COMPUTE_BUSY;    // 调整调度器状态为：正忙
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout / 1000;
+    ts.tv_nsec += (timeout % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
 
-            _lthread_compute_resume(lt);                    // 执行lthread
+    return (pthread_cond_timedwait(&compute_sched->run_mutex_cond,
+        &compute_sched->run_mutex, &ts));
+}
 
-            compute_sched->current_lthread = NULL;
-            compute_sched->compute_st = LT_COMPUTE_FREE;
+// computer sched的调度循环，参数arg是调度器
+static void*
+_lthread_compute_run(void *arg)
+{
+    struct lthread_compute_sched *compute_sched = arg;      
+    struct lthread_compute_item item;
+    struct lthread *lt = NULL;
+    int ret = 0;
+    int timedout = 0;
+    uint64_t *idle_word = _lthread_compute_idle_word(compute_sched);
+    uint64_t bit = _lthread_compute_bit(compute_sched);
 
-            /* resume it back on the  prev scheduler */
-            assert(pthread_mutex_lock(&lt->sched->defer_mutex) == 0);   // 执行完了这个ltherad后，还要把它还给原来的sched
-            TAILQ_INSERT_TAIL(&lt->sched->defer, lt, defer_next);       // NOTE: defer状态在这里!
-            lt->state &= CLEARBIT(LT_ST_RUNCOMPUTE);
-            assert(pthread_mutex_unlock(&lt->sched->defer_mutex) == 0);
+    assert(pthread_once(&key_once, once_routine) == 0);
+    assert(pthread_setspecific(compute_sched_key, arg) == 0);
 
-            /* signal the prev scheduler in case it was sleeping in a poll */
-            _lthread_poller_ev_trigger(lt->sched);      // NOTE：调度器可能阻塞在epoll_wait上，如果这里的计算执行完了，要让原调度器及时醒过来
+    while (1) {
+        if ((ret = _lthread_compute_next(compute_sched, &item)) == -1) {
+            assert(pthread_mutex_lock(&compute_sched->run_mutex) == 0);
+            /*
+             * announce we are going to sleep then look once more, a
+             * scheduler pushing in between either sees us idle or we
+             * see its lthread. pairs with _lthread_compute_add().
+             */
+            __atomic_store_n(&compute_sched->idle, 1, __ATOMIC_SEQ_CST);
+            __atomic_fetch_or(idle_word, bit, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if ((ret = _lthread_compute_next(compute_sched, &item)) == -1) {
+                if (__atomic_load_n(&compute_sched->retired,
+                    __ATOMIC_SEQ_CST)) {
+                    __atomic_fetch_and(idle_word, ~bit, __ATOMIC_SEQ_CST);
+                    __atomic_store_n(&compute_sched->idle, 0,
+                        __ATOMIC_SEQ_CST);
+                    compute_sched->running = 0;
+                    assert(pthread_mutex_unlock(
+                        &compute_sched->run_mutex) == 0);
+                    break;
+                }
+                if (_lthread_compute_idle_wait(compute_sched) == ETIMEDOUT)
+                    timedout = 1;
+            }
+            /* a scheduler may have claimed us already, that's fine too */
+            __atomic_fetch_and(idle_word, ~bit, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&compute_sched->idle, 0, __ATOMIC_SEQ_CST);
+            assert(pthread_mutex_unlock(&compute_sched->run_mutex) == 0);
+            if (ret == -1 && timedout)
+                _lthread_compute_shrink(compute_sched);
+            timedout = 0;
+            if (ret == -1)
+                continue;
         }
 
-        assert(pthread_mutex_lock(&compute_sched->run_mutex) == 0);
-        /* wait if we have no work to do, exit */
-        timeout.tv_sec = time(NULL) + THREAD_TIMEOUT_BEFORE_EXIT;
-        timeout.tv_nsec = 0;
-        status = pthread_cond_timedwait(&compute_sched->run_mutex_cond,
-            &compute_sched->run_mutex, &timeout);
-        assert(pthread_mutex_unlock(&compute_sched->run_mutex) == 0);
-
-        /* if we didn't timeout, then we got signaled to do some work */
-        if (status != ETIMEDOUT)        // [lmy] 这表明某个pthread丢了一个任务过来，于是compute sched有活干了
+        if (item.task != NULL) {
+            _lthread_compute_dequeued(compute_sched->pool, item.task->queued);
+            item.task->fn(item.task->arg);
+            _lthread_compute_task_done(item.task);
             continue;
+        }
 
-        /* lock the global sched to check if we have any pending work to do */
-        assert(pthread_mutex_lock(&sched_mutex) == 0);
+        lt = item.lt;
+        /* only _lthread_compute_add() pushes, after the stack was released */
+        assert(!(lt->state & BIT(LT_ST_PENDING_RUNCOMPUTE)));
+        _lthread_compute_dequeued(compute_sched->pool, lt->compute_queued);
+        compute_sched->current_lthread = lt;
 
-        assert(pthread_mutex_lock(&compute_sched->lthreads_mutex) == 0);
-        if (TAILQ_EMPTY(&compute_sched->lthreads)) {
+        lt->compute_sched = compute_sched;
+        _lthread_compute_resume(lt);                    // 执行lthread
 
-            LIST_REMOVE(compute_sched, compute_next);
+        compute_sched->current_lthread = NULL;
 
-            assert(pthread_mutex_unlock(&compute_sched->lthreads_mutex) == 0);
-            assert(pthread_mutex_unlock(&sched_mutex) == 0);
-            _lthread_compute_sched_free(compute_sched);
-            break;
-        }
+        /* resume it back on the  prev scheduler */
+        assert(pthread_mutex_lock(&lt->sched->defer_mutex) == 0);   // 执行完了这个ltherad后，还要把它还给原来的sched
+        TAILQ_INSERT_TAIL(&lt->sched->defer, lt, defer_next);       // NOTE: defer状态在这里!
+        lt->state &= CLEARBIT(LT_ST_RUNCOMPUTE);
+        assert(pthread_mutex_unlock(&lt->sched->defer_mutex) == 0);
 
-        assert(pthread_mutex_unlock(&compute_sched->lthreads_mutex) == 0);
-        assert(pthread_mutex_unlock(&sched_mutex) == 0);
+        /* signal the prev scheduler in case it was sleeping in a poll */
+        _lthread_poller_ev_trigger(lt->sched);      // NOTE：调度器可能阻塞在epoll_wait上，如果这里的计算执行完了，要让原调度器及时醒过来
     }
 
-
     return NULL;
 }
@@ -0,0 +1,348 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * lthread_dns.c
+ *
+ * Name resolution that doesn't stall the scheduler. getaddrinfo(3) runs on
+ * an io worker while the calling lthread parks, and successful answers are
+ * cached for a configurable ttl so repeat lookups of a host cost a copy.
+ * Lookups of a name already being resolved wait for that resolution
+ * instead of starting their own.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lthread_int.h"
+
+#define LT_DNS_BUCKETS  (256)
+#define LT_DNS_MAX      (1024)          /* cached names */
+#define LT_DNS_TTL      (60 * 1000)     /* msecs */
+
+struct lthread_dns_entry {
+    char                *node;
+    char                *service;
+    int                 flags;          /* the hints that matter */
+    int                 family;
+    int                 socktype;
+    int                 protocol;
+    uint32_t            hash;
+    struct addrinfo     *ai;            /* NULL while resolving */
+    uint64_t            expires;        /* usecs */
+    struct lthread_future *resolving;   /* completes with the EAI_* code */
+    LIST_ENTRY(lthread_dns_entry) next;
+};
+
+LIST_HEAD(lthread_dns_bucket, lthread_dns_entry);
+
+static pthread_mutex_t dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct lthread_dns_bucket dns_cache[LT_DNS_BUCKETS];
+static size_t dns_entries = 0;
+static uint64_t dns_ttl = LT_DNS_TTL;
+
+static uint32_t
+_lthread_dns_hash(const char *s, uint32_t h)
+{
+    /* fnv-1a */
+    for (; s != NULL && *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619u;
+
+    return (h);
+}
+
+static int
+_lthread_dns_streq(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+        return (a == b);
+
+    return (strcmp(a, b) == 0);
+}
+
+static struct lthread_dns_entry *
+_lthread_dns_find(const char *node, const char *service,
+    const struct addrinfo *hints, uint32_t hash)
+{
+    struct lthread_dns_entry *e = NULL;
+
+    LIST_FOREACH(e, &dns_cache[hash % LT_DNS_BUCKETS], next)
+        if (e->hash == hash &&
+            e->flags == hints->ai_flags &&
+            e->family == hints->ai_family &&
+            e->socktype == hints->ai_socktype &&
+            e->protocol == hints->ai_protocol &&
+            _lthread_dns_streq(e->node, node) &&
+            _lthread_dns_streq(e->service, service))
+            return (e);
+
+    return (NULL);
+}
+
+static void
+_lthread_dns_free(struct lthread_dns_entry *e)
+{
+    LIST_REMOVE(e, next);
+    dns_entries--;
+    if (e->ai != NULL)
+        freeaddrinfo(e->ai);
+    free(e->node);
+    free(e->service);
+    free(e);
+}
+
+/* makes room for one more name, dropping expired answers first */
+static int
+_lthread_dns_evict(uint64_t now)
+{
+    struct lthread_dns_entry *e = NULL, *e_tmp = NULL;
+    int i = 0;
+
+    for (i = 0; i < LT_DNS_BUCKETS && dns_entries >= LT_DNS_MAX; i++)
+        LIST_FOREACH_SAFE(e, &dns_cache[i], next, e_tmp)
+            if (e->resolving == NULL && e->expires <= now)
+                _lthread_dns_free(e);
+
+    return (dns_entries < LT_DNS_MAX ? 0 : -1);
+}
+
+/*
+ * Copies ai into a list the caller owns and frees with
+ * lthread_freeaddrinfo(). Each node carries its address and canonical name
+ * in the same allocation.
+ */
+static int
+_lthread_dns_copy(const struct addrinfo *ai, struct addrinfo **res)
+{
+    struct addrinfo *copy = NULL, **tail = res;
+    size_t namelen = 0;
+
+    *res = NULL;
+    for (; ai != NULL; ai = ai->ai_next) {
+        namelen = ai->ai_canonname ? strlen(ai->ai_canonname) + 1 : 0;
+        if ((copy = malloc(sizeof(struct addrinfo) + ai->ai_addrlen +
+            namelen)) == NULL) {
+            lthread_freeaddrinfo(*res);
+            *res = NULL;
+            return (EAI_MEMORY);
+        }
+        *copy = *ai;
+        copy->ai_addr = (struct sockaddr *)(copy + 1);
+        memcpy(copy->ai_addr, ai->ai_addr, ai->ai_addrlen);
+        copy->ai_canonname = NULL;
+        if (namelen) {
+            copy->ai_canonname = (char *)copy->ai_addr + ai->ai_addrlen;
+            memcpy(copy->ai_canonname, ai->ai_canonname, namelen);
+        }
+        copy->ai_next = NULL;
+        *tail = copy;
+        tail = &copy->ai_next;
+    }
+
+    return (0);
+}
+
+/* resolves on an io worker, bypassing the cache */
+static int
+_lthread_dns_uncached(const char *node, const char *service,
+    const struct addrinfo *hints, struct addrinfo **res)
+{
+    struct lthread_io_req req = {0};
+    struct addrinfo *ai = NULL;
+    int ret = 0;
+
+    req.op = LT_IO_GETADDRINFO;
+    req.path = node;
+    req.service = service;
+    req.hints = hints;
+    req.ai = &ai;
+    _lthread_io_call(&req);
+    if ((ret = req.ret) != 0) {
+        if (ret == EAI_SYSTEM)
+            errno = req.err;
+        return (ret);
+    }
+
+    ret = _lthread_dns_copy(ai, res);
+    freeaddrinfo(ai);
+
+    return (ret);
+}
+
+/*
+ * Resolves e on an io worker, copies the answer to res and publishes it to
+ * the lookups waiting on e.
+ */
+static int
+_lthread_dns_resolve(struct lthread_dns_entry *e, const struct addrinfo *hints,
+    struct addrinfo **res)
+{
+    struct lthread_io_req req = {0};
+    struct lthread_future *resolving = NULL;
+    struct addrinfo *ai = NULL;
+    int ret = 0;
+
+    req.op = LT_IO_GETADDRINFO;
+    req.path = e->node;
+    req.service = e->service;
+    req.hints = hints;
+    req.ai = &ai;
+    _lthread_io_call(&req);
+    if ((ret = req.ret) == EAI_SYSTEM)
+        errno = req.err;
+
+    assert(pthread_mutex_lock(&dns_mutex) == 0);
+    resolving = e->resolving;
+    e->resolving = NULL;
+    if (ret == 0) {
+        e->ai = ai;
+        e->expires = _lthread_usec_now() + dns_ttl * 1000;
+        ret = _lthread_dns_copy(ai, res);
+    } else {
+        /* failures aren't cached, the next lookup tries again */
+        _lthread_dns_free(e);
+    }
+    assert(pthread_mutex_unlock(&dns_mutex) == 0);
+
+    lthread_future_set(resolving, (void *)(intptr_t)req.ret, req.err);
+    lthread_future_free(resolving);
+
+    return (ret);
+}
+
+/*
+ * getaddrinfo(3) that parks the calling lthread instead of blocking its
+ * scheduler. Answers are cached for the ttl set with
+ * lthread_getaddrinfo_set_ttl(). Returns 0 or an EAI_* code like
+ * getaddrinfo(3); free *res with lthread_freeaddrinfo().
+ */
+int
+lthread_getaddrinfo(const char *node, const char *service,
+    const struct addrinfo *hints, struct addrinfo **res)
+{
+    static const struct addrinfo no_hints = {0};
+    struct lthread_dns_entry *e = NULL;
+    struct lthread_future *resolving = NULL;
+    uint64_t now = 0;
+    uint32_t hash = 0;
+    int ret = 0;
+
+    if (hints == NULL)
+        hints = &no_hints;
+    if (dns_ttl == 0)
+        return (_lthread_dns_uncached(node, service, hints, res));
+    hash = _lthread_dns_hash(node, 2166136261u);
+    hash = _lthread_dns_hash(service, hash * 31 + hints->ai_family);
+
+    while (1) {
+        now = _lthread_usec_now();
+        assert(pthread_mutex_lock(&dns_mutex) == 0);
+        e = _lthread_dns_find(node, service, hints, hash);
+        if (e != NULL && e->resolving == NULL && e->expires > now) {
+            ret = _lthread_dns_copy(e->ai, res);
+            assert(pthread_mutex_unlock(&dns_mutex) == 0);
+            return (ret);
+        }
+        if (e == NULL || e->resolving == NULL)
+            break;
+
+        /* someone is on it already, wait for their answer */
+        resolving = e->resolving;
+        _lthread_future_hold(resolving);
+        assert(pthread_mutex_unlock(&dns_mutex) == 0);
+
+        lthread_future_wait(resolving, 0);
+        ret = (int)(intptr_t)lthread_future_result(resolving);
+        if (ret == EAI_SYSTEM)
+            errno = lthread_future_error(resolving);
+        lthread_future_free(resolving);
+        if (ret != 0)
+            return (ret);
+    }
+
+    /* stale or unknown, resolve it ourselves */
+    if (e != NULL) {
+        freeaddrinfo(e->ai);
+        e->ai = NULL;
+    } else if (_lthread_dns_evict(now) == -1 ||
+        (e = calloc(1, sizeof(struct lthread_dns_entry))) == NULL) {
+        /* cache is full of live names, go around it */
+        assert(pthread_mutex_unlock(&dns_mutex) == 0);
+        return (_lthread_dns_uncached(node, service, hints, res));
+    } else {
+        if ((node && (e->node = strdup(node)) == NULL) ||
+            (service && (e->service = strdup(service)) == NULL)) {
+            free(e->node);
+            free(e);
+            assert(pthread_mutex_unlock(&dns_mutex) == 0);
+            return (EAI_MEMORY);
+        }
+        e->flags = hints->ai_flags;
+        e->family = hints->ai_family;
+        e->socktype = hints->ai_socktype;
+        e->protocol = hints->ai_protocol;
+        e->hash = hash;
+        LIST_INSERT_HEAD(&dns_cache[hash % LT_DNS_BUCKETS], e, next);
+        dns_entries++;
+    }
+    if (lthread_future_create(&e->resolving) == -1) {
+        e->resolving = NULL;
+        _lthread_dns_free(e);
+        assert(pthread_mutex_unlock(&dns_mutex) == 0);
+        return (EAI_MEMORY);
+    }
+    assert(pthread_mutex_unlock(&dns_mutex) == 0);
+
+    return (_lthread_dns_resolve(e, hints, res));
+}
+
+void
+lthread_freeaddrinfo(struct addrinfo *res)
+{
+    struct addrinfo *next = NULL;
+
+    for (; res != NULL; res = next) {
+        next = res->ai_next;
+        free(res);
+    }
+}
+
+/*
+ * Sets how long answers stay cached, in msecs. getaddrinfo(3) doesn't pass
+ * on the records' own ttls, so one ttl covers every name; 0 turns caching
+ * off. Takes effect for answers cached from now on.
+ */
+void
+lthread_getaddrinfo_set_ttl(uint64_t msecs)
+{
+    __atomic_store_n(&dns_ttl, msecs, __ATOMIC_RELAXED);
+}
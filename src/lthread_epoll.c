@@ -36,14 +36,72 @@ _lthread_poller_create(void)
     return (epoll_create(1024));
 }
 
+/*
+ * Arms the scheduler's timerfd to fire after `t`, creating it and adding it
+ * to the poller on first use. Returns -1 if no timerfd is available.
+ */
+static int
+_lthread_poller_arm_timer(struct lthread_sched *sched, struct timespec t)
+{
+    struct itimerspec its = {{0, 0}, {0, 0}};
+    struct epoll_event ev;
+
+    if (sched->no_timerfd)
+        return (-1);
+
+    if (sched->timerfd == -1) {
+        sched->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (sched->timerfd == -1) {
+            /* don't retry on every poll, stick to whole msecs */
+            sched->no_timerfd = 1;
+            return (-1);
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = sched->timerfd;
+        if (epoll_ctl(sched->poller_fd, EPOLL_CTL_ADD, sched->timerfd,
+            &ev) == -1) {
+            close(sched->timerfd);
+            sched->timerfd = -1;
+            sched->no_timerfd = 1;
+            return (-1);
+        }
+    }
+
+    its.it_value = t;
+    return (timerfd_settime(sched->timerfd, 0, &its, NULL));
+}
+
 // 调用epoll_wait, 获取就绪的epoll_event个数
+/*
+ * Waits up to `t` with nsec precision using epoll_pwait2. Kernels older than
+ * 5.11 get epoll_wait with a timerfd covering the sub-msec part of `t`.
+ */
 inline int
 _lthread_poller_poll(struct timespec t)
 {
     struct lthread_sched *sched = lthread_get_sched();
+    int ret = 0;
+    int msecs = 0;
+
+#ifdef SYS_epoll_pwait2
+    if (!sched->no_pwait2) {
+        ret = syscall(SYS_epoll_pwait2, sched->poller_fd, sched->eventlist,
+            LT_MAX_EVENTS, &t, NULL, 0);
+        if (ret != -1 || errno != ENOSYS)
+            return (ret);
+        sched->no_pwait2 = 1;
+    }
+#endif
+
+    msecs = t.tv_sec * 1000 + t.tv_nsec / 1000000;
+    if (t.tv_nsec % 1000000 != 0) {
+        /* the timer wakes us up early, rounding up is the fallback */
+        _lthread_poller_arm_timer(sched, t);
+        msecs++;
+    }
 
     return (epoll_wait(sched->poller_fd, sched->eventlist, LT_MAX_EVENTS,
-        t.tv_sec*1000.0 + t.tv_nsec/1000000.0));    // 调度器自身可能会在这里阻塞，_lthread_poller_ev_trigger唤醒的就是这个时候的调度器！！！
+        msecs));    // 调度器自身可能会在这里阻塞，_lthread_poller_ev_trigger唤醒的就是这个时候的调度器！！！
 }
 
 // 注销一个监听读类型事件的文件描述符
@@ -171,6 +229,17 @@ _lthread_poller_ev_clear_trigger(void)
     assert(read(sched->eventfd, &tmp, sizeof(uint64_t)) == sizeof(uint64_t));   
 }
 
+/*
+ * Clears the sub-msec timer after it fired.
+ */
+inline void
+_lthread_poller_ev_clear_timer(void)
+{
+    uint64_t tmp;
+    struct lthread_sched *sched = lthread_get_sched();
+    read(sched->timerfd, &tmp, sizeof(uint64_t));
+}
+
 // 对eventfd进行一次写操作
 inline void
 _lthread_poller_ev_trigger(struct lthread_sched *sched)
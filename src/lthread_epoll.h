@@ -5,6 +5,8 @@
 #include <assert.h>
 #include <string.h>
 #include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 int _lthread_poller_create(void);
@@ -20,6 +22,7 @@ int _lthread_poller_ev_is_write(struct epoll_event *ev);
 int _lthread_poller_ev_is_read(struct epoll_event *ev);
 void _lthread_poller_ev_register_trigger(void);
 void _lthread_poller_ev_clear_trigger(void);
+void _lthread_poller_ev_clear_timer(void);
 void _lthread_poller_ev_trigger(struct lthread_sched *sched);
 
 #endif
\ No newline at end of file
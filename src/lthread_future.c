@@ -0,0 +1,499 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * lthread_future.c
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lthread_int.h"
+
+enum {
+    LT_FUTURE_LINKS = 8             /* links kept on the waiter's stack */
+};
+
+/* one parked lthread, shared by the links it put on each future */
+struct lthread_future_waiter {
+    struct lthread      *lt;        /* NULL for a pthread blocked on cond */
+    int                 claimed;    /* set by whoever resumes lt */
+    pthread_mutex_t     mutex;      /* pthreads only, guards woken */
+    pthread_cond_t      cond;
+    int                 woken;
+};
+
+struct lthread_future_link {
+    struct lthread_future_waiter *waiter;
+    int                 linked;
+    LIST_ENTRY(lthread_future_link) next;
+};
+
+LIST_HEAD(lthread_future_link_l, lthread_future_link);
+
+struct lthread_future {
+    pthread_mutex_t     mutex;
+    int                 done;
+    void                *result;
+    int                 err;
+    int                 refs;       /* owner, a running producer, holders */
+    struct lthread_future_link_l waiters;
+    void                *(*fn)(void *);
+    void                *arg;
+    struct lthread_io_req io;
+};
+
+static struct lthread_future *
+_lthread_future_new(int refs)
+{
+    struct lthread_future *f = NULL;
+
+    if ((f = calloc(1, sizeof(struct lthread_future))) == NULL)
+        return (NULL);
+
+    assert(pthread_mutex_init(&f->mutex, NULL) == 0);
+    LIST_INIT(&f->waiters);
+    f->refs = refs;
+
+    return (f);
+}
+
+static void
+_lthread_future_release(struct lthread_future *f)
+{
+    if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    assert(pthread_mutex_destroy(&f->mutex) == 0);
+    free(f);
+}
+
+/* takes another reference on f, dropped with lthread_future_free() */
+void
+_lthread_future_hold(struct lthread_future *f)
+{
+    __atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+}
+
+/* wakes a pthread blocked in _lthread_future_block(), we claimed it */
+static void
+_lthread_future_wake(struct lthread_future_waiter *waiter)
+{
+    assert(pthread_mutex_lock(&waiter->mutex) == 0);
+    waiter->woken = 1;
+    assert(pthread_cond_signal(&waiter->cond) == 0);
+    assert(pthread_mutex_unlock(&waiter->mutex) == 0);
+}
+
+/*
+ * Marks f done and resumes every lthread parked on it that nobody else has
+ * claimed yet. Can be called from any pthread.
+ */
+static int
+_lthread_future_complete(struct lthread_future *f, void *result, int err)
+{
+    struct lthread_future_link *link = NULL;
+    struct lthread *lt = NULL;
+
+    assert(pthread_mutex_lock(&f->mutex) == 0);
+    if (f->done) {
+        assert(pthread_mutex_unlock(&f->mutex) == 0);
+        errno = EINVAL;
+        return (-1);
+    }
+
+    f->result = result;
+    f->err = err;
+    __atomic_store_n(&f->done, 1, __ATOMIC_RELEASE);
+
+    while ((link = LIST_FIRST(&f->waiters)) != NULL) {
+        LIST_REMOVE(link, next);
+        link->linked = 0;
+        /* lost to another future or to the timeout */
+        if (__atomic_exchange_n(&link->waiter->claimed, 1,
+            __ATOMIC_ACQ_REL) != 0)
+            continue;
+
+        lt = link->waiter->lt;
+        if (lt == NULL) {
+            _lthread_future_wake(link->waiter);
+            continue;
+        }
+        assert(pthread_mutex_lock(&lt->sched->defer_mutex) == 0);
+        TAILQ_INSERT_TAIL(&lt->sched->defer, lt, defer_next);
+        assert(pthread_mutex_unlock(&lt->sched->defer_mutex) == 0);
+        _lthread_poller_ev_trigger(lt->sched);
+    }
+    assert(pthread_mutex_unlock(&f->mutex) == 0);
+
+    return (0);
+}
+
+/* creates a future completed by the caller with lthread_future_set() */
+int
+lthread_future_create(struct lthread_future **f)
+{
+    if ((*f = _lthread_future_new(1)) == NULL)
+        return (-1);
+
+    return (0);
+}
+
+/* completes f, fails with EINVAL if it was already completed */
+int
+lthread_future_set(struct lthread_future *f, void *result, int err)
+{
+    return (_lthread_future_complete(f, result, err));
+}
+
+/* runs on a compute worker */
+static void
+_lthread_future_compute_run(void *arg)
+{
+    struct lthread_future *f = arg;
+    void *result = NULL;
+
+    errno = 0;
+    result = f->fn(f->arg);
+    _lthread_future_complete(f, result, errno);
+    _lthread_future_release(f);
+}
+
+int
+lthread_future_compute(struct lthread_future **f, void *(*fn)(void *),
+    void *arg)
+{
+    return (lthread_future_compute_pool(f, NULL, fn, arg));
+}
+
+/*
+ * Starts fn(arg) on pool and returns right away. The future completes with
+ * fn's return value and the errno it left behind.
+ */
+int
+lthread_future_compute_pool(struct lthread_future **f,
+    struct lthread_compute_pool *pool, void *(*fn)(void *), void *arg)
+{
+    struct lthread_future *fut = NULL;
+
+    if ((fut = _lthread_future_new(2)) == NULL)
+        return (-1);
+
+    fut->fn = fn;
+    fut->arg = arg;
+    if (_lthread_compute_async(pool, _lthread_future_compute_run, fut) == -1) {
+        _lthread_future_release(fut);
+        _lthread_future_release(fut);
+        return (-1);
+    }
+    *f = fut;
+
+    return (0);
+}
+
+/* called by an io worker */
+static void
+_lthread_future_io_done(struct lthread_io_req *req)
+{
+    struct lthread_future *f = req->arg;
+
+    _lthread_future_complete(f, (void *)(intptr_t)req->ret, req->err);
+    _lthread_future_release(f);
+}
+
+static int
+_lthread_future_io(struct lthread_future **f, enum lthread_io_op op, int fd,
+    void *buf, size_t nbytes, off_t offset)
+{
+    struct lthread_future *fut = NULL;
+
+    if ((fut = _lthread_future_new(2)) == NULL)
+        return (-1);
+
+    fut->io.op = op;
+    fut->io.fd = fd;
+    fut->io.buf = buf;
+    fut->io.nbytes = nbytes;
+    fut->io.offset = offset;
+    fut->io.done = _lthread_future_io_done;
+    fut->io.arg = fut;
+    *f = fut;
+    _lthread_io_submit(&fut->io);
+
+    return (0);
+}
+
+/*
+ * Starts a read(2)/write(2) on an io worker and returns right away. The
+ * future's result is the ssize_t the call returned, cast through intptr_t,
+ * and its error is the errno when that was -1. buf must stay valid until the
+ * future is done.
+ */
+int
+lthread_future_io_read(struct lthread_future **f, int fd, void *buf,
+    size_t nbytes)
+{
+    return (_lthread_future_io(f, LT_IO_READ, fd, buf, nbytes, 0));
+}
+
+int
+lthread_future_io_write(struct lthread_future **f, int fd, void *buf,
+    size_t nbytes)
+{
+    return (_lthread_future_io(f, LT_IO_WRITE, fd, buf, nbytes, 0));
+}
+
+/* same as lthread_future_io_read() at offset, leaving the file offset be */
+int
+lthread_future_io_pread(struct lthread_future **f, int fd, void *buf,
+    size_t nbytes, off_t offset)
+{
+    return (_lthread_future_io(f, LT_IO_PREAD, fd, buf, nbytes, offset));
+}
+
+int
+lthread_future_done(struct lthread_future *f)
+{
+    return (__atomic_load_n(&f->done, __ATOMIC_ACQUIRE));
+}
+
+static int
+_lthread_future_first_done(struct lthread_future **fs, int n)
+{
+    int i = 0;
+
+    for (i = 0; i < n; i++)
+        if (lthread_future_done(fs[i]))
+            return (i);
+
+    return (-1);
+}
+
+/*
+ * Links waiter to each of the n futures until one turns out to be done
+ * already. Returns how many got linked, n if none is done.
+ */
+static int
+_lthread_future_link(struct lthread_future **fs, int n,
+    struct lthread_future_link *links, struct lthread_future_waiter *waiter)
+{
+    int nlinked = 0;
+
+    for (nlinked = 0; nlinked < n; nlinked++) {
+        links[nlinked].waiter = waiter;
+        assert(pthread_mutex_lock(&fs[nlinked]->mutex) == 0);
+        if (fs[nlinked]->done) {
+            assert(pthread_mutex_unlock(&fs[nlinked]->mutex) == 0);
+            break;
+        }
+        links[nlinked].linked = 1;
+        LIST_INSERT_HEAD(&fs[nlinked]->waiters, &links[nlinked], next);
+        assert(pthread_mutex_unlock(&fs[nlinked]->mutex) == 0);
+    }
+
+    return (nlinked);
+}
+
+static void
+_lthread_future_unlink(struct lthread_future **fs, int nlinked,
+    struct lthread_future_link *links)
+{
+    int i = 0;
+
+    for (i = 0; i < nlinked; i++) {
+        assert(pthread_mutex_lock(&fs[i]->mutex) == 0);
+        if (links[i].linked)
+            LIST_REMOVE(&links[i], next);
+        assert(pthread_mutex_unlock(&fs[i]->mutex) == 0);
+    }
+}
+
+/*
+ * Not in an lthread, nothing to park: the calling pthread blocks on its
+ * waiter's condvar instead, signalled by whoever completes a future first.
+ */
+static int
+_lthread_future_block(struct lthread_future **fs, int n,
+    struct lthread_future_link *links, uint64_t timeout)
+{
+    struct lthread_future_waiter waiter = {0};
+    struct timespec ts;
+    int nlinked = 0, woken = 0, timedout = 0;
+
+    assert(pthread_mutex_init(&waiter.mutex, NULL) == 0);
+    assert(pthread_cond_init(&waiter.cond, NULL) == 0);
+    if (timeout) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += timeout / 1000;
+        ts.tv_nsec += (timeout % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+    }
+
+    nlinked = _lthread_future_link(fs, n, links, &waiter);
+
+    assert(pthread_mutex_lock(&waiter.mutex) == 0);
+    while (!waiter.woken && nlinked == n) {
+        if (!timeout)
+            assert(pthread_cond_wait(&waiter.cond, &waiter.mutex) == 0);
+        else if (pthread_cond_timedwait(&waiter.cond, &waiter.mutex,
+            &ts) == ETIMEDOUT)
+            break;
+    }
+    woken = waiter.woken;
+    assert(pthread_mutex_unlock(&waiter.mutex) == 0);
+
+    if (!woken &&
+        __atomic_exchange_n(&waiter.claimed, 1, __ATOMIC_ACQ_REL) == 0) {
+        /* nobody is going to signal us */
+        timedout = (nlinked == n);
+    } else if (!woken) {
+        /* a completer claimed us, it's about to signal, wait for it */
+        assert(pthread_mutex_lock(&waiter.mutex) == 0);
+        while (!waiter.woken)
+            assert(pthread_cond_wait(&waiter.cond, &waiter.mutex) == 0);
+        assert(pthread_mutex_unlock(&waiter.mutex) == 0);
+    }
+
+    _lthread_future_unlink(fs, nlinked, links);
+    assert(pthread_cond_destroy(&waiter.cond) == 0);
+    assert(pthread_mutex_destroy(&waiter.mutex) == 0);
+
+    return (timedout ? -2 : _lthread_future_first_done(fs, n));
+}
+
+/*
+ * Parks the calling lthread until one of the n futures is done and returns
+ * its index, or -2 if `timeout` msecs passed first (0 waits forever). The
+ * scheduler keeps running other lthreads meanwhile, and the futures stay
+ * owned by the caller. Outside an lthread the calling pthread blocks instead.
+ */
+int
+lthread_future_wait_any(struct lthread_future **fs, int n, uint64_t timeout)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt = sched ? sched->current_lthread : NULL;
+    struct lthread_future_link stack_links[LT_FUTURE_LINKS];
+    struct lthread_future_link *links = stack_links;
+    struct lthread_future_waiter waiter = {0};
+    int timedout = 0;
+    int nlinked = 0;
+    int i = 0;
+
+    if (n <= 0) {
+        errno = EINVAL;
+        return (-1);
+    }
+    waiter.lt = lt;
+
+    if ((i = _lthread_future_first_done(fs, n)) != -1)
+        return (i);
+
+    if (n > LT_FUTURE_LINKS &&
+        (links = calloc(n, sizeof(struct lthread_future_link))) == NULL)
+        return (-1);
+
+    if (lt == NULL) {
+        i = _lthread_future_block(fs, n, links, timeout);
+        if (links != stack_links)
+            free(links);
+        return (i);
+    }
+
+    /* completers push us to defer, which takes us off busy */
+    lt->state |= BIT(LT_ST_WAIT_FUTURE);
+    LIST_INSERT_HEAD(&lt->sched->busy, lt, busy_next);
+
+    nlinked = _lthread_future_link(fs, n, links, &waiter);
+
+    if (nlinked < n &&
+        __atomic_exchange_n(&waiter.claimed, 1, __ATOMIC_ACQ_REL) == 0) {
+        /* found one done while linking, and nobody queued us */
+        LIST_REMOVE(lt, busy_next);
+    } else {
+        /*
+         * park. if a future completed while we were linking, we're already
+         * on defer and this yield just takes that resumption.
+         */
+        _lthread_sched_sleep_us(lt, nlinked < n ? 0 : timeout * 1000u);
+        if (__atomic_exchange_n(&waiter.claimed, 1, __ATOMIC_ACQ_REL) == 0) {
+            LIST_REMOVE(lt, busy_next);
+            timedout = 1;
+        } else if (lt->state & BIT(LT_ST_EXPIRED)) {
+            /* the timer raced a completer that already queued us on defer */
+            _lthread_yield(lt);
+        }
+    }
+    lt->state &= CLEARBIT(LT_ST_WAIT_FUTURE);
+
+    _lthread_future_unlink(fs, nlinked, links);
+    if (links != stack_links)
+        free(links);
+
+    if (timedout)
+        return (-2);
+
+    return (_lthread_future_first_done(fs, n));
+}
+
+/* returns 0 once f is done, or -2 if `timeout` msecs passed first */
+int
+lthread_future_wait(struct lthread_future *f, uint64_t timeout)
+{
+    int ret = lthread_future_wait_any(&f, 1, timeout);
+
+    return (ret < 0 ? ret : 0);
+}
+
+void *
+lthread_future_result(struct lthread_future *f)
+{
+    return (f->result);
+}
+
+int
+lthread_future_error(struct lthread_future *f)
+{
+    return (f->err);
+}
+
+/*
+ * Drops the caller's reference. A producer that is still running keeps the
+ * future alive until it completes, so a future can be freed without waiting
+ * on it. It must not be freed while an lthread is waiting on it.
+ */
+void
+lthread_future_free(struct lthread_future *f)
+{
+    _lthread_future_release(f);
+}
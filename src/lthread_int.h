@@ -32,6 +32,8 @@
 
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <errno.h>
 #include <pthread.h>
 #include <time.h>
@@ -40,8 +42,16 @@
 #include "queue.h"
 #include "tree.h"
 
+typedef struct lthread lthread_t;
+typedef struct lthread_cond lthread_cond_t;
+typedef struct lthread_sched lthread_sched_t;
+
+#include "lthread.h"
+
 #define LT_MAX_EVENTS    (1024)
+#define LT_SPLICE_PIPES  (16)
 #define MAX_STACK_SIZE (128*1024) /* 128k */
+#define LT_MAX_NUMA_NODES   (64)
 
 #define BIT(x) (1 << (x))
 #define CLEARBIT(x) ~(1 << (x))
@@ -49,6 +59,9 @@
 struct lthread;
 struct lthread_sched;
 struct lthread_compute_sched;
+struct lthread_compute_pool;
+struct lthread_uring;
+struct lthread_log_ring;
 struct lthread_io_sched;
 struct lthread_cond;
 
@@ -76,11 +89,6 @@ enum lthread_event {
     LT_EV_WRITE
 };
 
-enum lthread_compute_st {   // compute 调度器的状态（在lthread_compute.c中用到）
-    LT_COMPUTE_BUSY,
-    LT_COMPUTE_FREE,
-};
-
 enum lthread_st {
     LT_ST_WAIT_READ,    /* lthread waiting for READ on socket */
     LT_ST_WAIT_WRITE,   /* lthread waiting for WRITE on socket */
@@ -93,11 +101,15 @@ enum lthread_st {
     LT_ST_FDEOF,        /* lthread socket has shut down */
     LT_ST_DETACH,       /* lthread frees when done, else it waits to join */
     LT_ST_CANCELLED,    /* lthread has been cancelled */
-    LT_ST_PENDING_RUNCOMPUTE, /* lthread needs to run in compute sched, step1 */
-    LT_ST_RUNCOMPUTE,   /* lthread needs to run in compute sched (2), step2 */
-    LT_ST_WAIT_IO_READ, /* lthread waiting for READ IO to finish */
-    LT_ST_WAIT_IO_WRITE,/* lthread waiting for WRITE IO to finish */
-    LT_ST_WAIT_MULTI    /* lthread waiting on multiple fds */
+    LT_ST_PENDING_RUNCOMPUTE, /* lthread yielding to go to compute, not queued yet */
+    LT_ST_RUNCOMPUTE,   /* lthread queued or running in a compute worker */
+    LT_ST_WAIT_IO_READ, /* lthread waiting for a read/open/stat to finish */
+    LT_ST_WAIT_IO_WRITE,/* lthread waiting for a write/sync/close to finish */
+    LT_ST_WAIT_MULTI,   /* lthread waiting on multiple fds */
+    LT_ST_PENDING_MIGRATE, /* lthread needs to move to another scheduler */
+    LT_ST_ADMIT_QUEUED, /* lthread spawn is waiting for a slot, no stack */
+    LT_ST_WAIT_COMPUTE, /* lthread parked until its compute tasks are done */
+    LT_ST_WAIT_FUTURE   /* lthread parked until a future completes */
 };
 
 struct lthread {
@@ -125,21 +137,19 @@ struct lthread {
     TAILQ_ENTRY(lthread)    ready_next;     /* ready to run list */
     TAILQ_ENTRY(lthread)    defer_next;     /* ready to run after deferred job */
     TAILQ_ENTRY(lthread)    cond_next;      /* waiting on a cond var */
-    TAILQ_ENTRY(lthread)    io_next;        /* waiting its turn in io */
     TAILQ_ENTRY(lthread)    compute_next;   /* waiting to run in compute sched */
-    struct {
-        void *buf;
-        size_t nbytes;
-        int fd;
-        int ret;
-        int err;
-    } io;
     /* lthread_compute schduler - when running in compute block */
     struct lthread_compute_sched    *compute_sched;         // 若lthread执行在一个compute sched上就会注册这个信息
+    uint64_t                compute_queued; /* when it was queued for compute */
+    struct lthread_compute_pool     *compute_pool;          /* pool it runs on */
     /* 以下用于一个lt监听多个文件描述符，基于linux的poll相关数据结构 */
     int ready_fds; /* # of fds that are ready. for poll(2) */   // 已经就绪的fd个数
     struct pollfd *pollfds;     // lt监听的fd数组
     nfds_t nfds;                // lt监听的fd个数
+    /* scheduler lthread is moving to and whether it was waiting on fd_wait */
+    struct lthread_sched    *migrate_sched;
+    int                     migrate_wait;
+    int                     migrate_node;   /* numa node it's leaving */
 };
 
 RB_HEAD(lthread_rb_sleep, lthread);     // 使lthread_rb_sleep 成为一种结构体名称
@@ -150,21 +160,100 @@ struct lthread_cond {
     struct lthread_q blocked_lthreads;      // 阻塞在该cond上的线程队列
 };
 
+enum lthread_io_op {
+    LT_IO_READ,
+    LT_IO_WRITE,
+    LT_IO_PREAD,
+    LT_IO_PWRITE,
+    LT_IO_READV,
+    LT_IO_WRITEV,
+    LT_IO_FSYNC,
+    LT_IO_FDATASYNC,
+    LT_IO_OPEN,
+    LT_IO_STAT,
+    LT_IO_FSTAT,
+    LT_IO_CLOSE,
+    LT_IO_UNLINK,
+    LT_IO_GETADDRINFO
+};
+
+/*
+ * A request handed to an io worker or the scheduler's io_uring. If `lt` is
+ * set it's resumed on its scheduler when the op is done, otherwise the io
+ * worker calls `done`.
+ */
+struct lthread_io_req {
+    enum lthread_io_op  op;
+    int                 fd;
+    void                *buf;
+    size_t              nbytes;
+    off_t               offset;         /* pread/pwrite */
+    const struct iovec  *iov;           /* readv/writev */
+    int                 iovcnt;
+    const char          *path;          /* open/stat/unlink */
+    int                 flags;          /* open */
+    mode_t              mode;
+    struct stat         *st;            /* stat/fstat */
+    const char          *service;       /* getaddrinfo, node is in path */
+    const struct addrinfo *hints;
+    struct addrinfo     **ai;
+    ssize_t             ret;
+    int                 err;
+    uint64_t            queued;         /* when an io worker got it */
+    struct lthread      *lt;
+    void                (*done)(struct lthread_io_req *req);
+    void                *arg;
+    TAILQ_ENTRY(lthread_io_req) next;
+};
+
+
 struct lthread_sched {
     uint64_t            birth;                      // 创建调度器的时间，在sched_create中初始化
     struct cpu_ctx      ctx;
     void                *stack;
     size_t              stack_size;
     int                 spawned_lthreads;
+    /* admission control, see lthread_sched_set_limit() */
+    size_t              max_lthreads;
+    size_t              max_queued;
+    int                 admit_policy;
+    size_t              live_lthreads;              /* lthreads holding a stack */
+    size_t              queued_lthreads;
+    struct lthread_q    admit_queue;                /* spawns waiting for a stack */
+    struct lthread_cond admit_cond;                 /* creators waiting for a slot */
+    uint64_t            created_lthreads;
+    uint64_t            admit_rejected;
+    uint64_t            admit_blocked;
+    uint64_t            admit_queued;
+    /* ready queue budget per iteration, see lthread_sched_set_budget() */
+    uint32_t            ready_budget;
+    uint64_t            ready_budget_usecs;
+    struct lthread      *ready_last;                /* last lthread of this ready pass */
+    uint64_t            stats_iterations;
+    uint64_t            stats_ready_resumed;
+    uint64_t            stats_ready_max;
+    uint64_t            stats_ready_usecs_max;
+    uint64_t            stats_budget_exhausted;
+    uint64_t            stats_events;
+    uint64_t            stats_events_max;
     uint64_t            default_timeout;
     struct lthread      *current_lthread;
     int                 page_size;
+    int                 numa_node;                  /* -1 if not pinned to a node */
     /* poller variables */
     int                 poller_fd;                  // epoll实例的文件描述符
 #if defined(__FreeBSD__) || defined(__APPLE__)
     struct kevent       changelist[LT_MAX_EVENTS];
 #endif
     int                 eventfd;
+    int                 timerfd;                    /* sub-msec timeouts w/o epoll_pwait2, -1 if none yet */
+    int                 no_timerfd;                 /* timerfd_create failed, round up to msecs */
+    int                 no_pwait2;                  /* kernel lacks epoll_pwait2 */
+    struct lthread_uring *uring;                    /* io_uring for file io, see lthread_uring.c */
+    int                 no_uring;                   /* use io workers instead */
+    struct lthread_log_ring *log_ring;              /* buffered lthread_log() output */
+    int                 splice_pipes[LT_SPLICE_PIPES][2]; /* empty pipes for lthread_splice() */
+    int                 nsplice_pipes;
     POLL_EVENT_TYPE     eventlist[LT_MAX_EVENTS];   // epoll实例中的监听的事件集合
     int                 nevents;
     int                 num_new_events;
@@ -176,6 +265,8 @@ struct lthread_sched {
     /* lthreads ready to run after io or compute is done */
     struct lthread_q        defer;      // 1) 这里的io和compute类似，也是由一个专门的线程去做，定义了lthread_io_worker这个结构，功能类似于compute sched但更简单
                                         // 2) compute sched的_lthread_compute_run中提到，此状态代表该lthread刚刚从一个compute sched还回来
+    /* lthreads handed over by other schedulers, protected by defer_mutex */
+    struct lthread_q        migrate;
     /* lthreads in join/cond_wait/io/compute */
     struct lthread_l        busy;       // 虽然都是busy状态，但实质以及处理的方式却不相同
                                         // compute密集型会放在另外一个线程上去运行
@@ -199,16 +290,39 @@ void        _lthread_yield(struct lthread *lt);
 void        _lthread_free(struct lthread *lt);
 void        _lthread_desched_sleep(struct lthread *lt);
 void        _lthread_sched_sleep(struct lthread *lt, uint64_t msecs);
+void        _lthread_sched_sleep_us(struct lthread *lt, uint64_t usecs);
 void        _lthread_sched_busy_sleep(struct lthread *lt, uint64_t msecs);
+void        _lthread_sched_busy_sleep_us(struct lthread *lt, uint64_t usecs);
 void        _lthread_cancel_event(struct lthread *lt);
 struct lthread* _lthread_desched_event(int fd, enum lthread_event e);
 void        _lthread_sched_event(struct lthread *lt, int fd,
     enum lthread_event e, uint64_t timeout);
+void        _lthread_sched_event_us(struct lthread *lt, int fd,
+    enum lthread_event e, uint64_t timeout);
 
 int         _switch(struct cpu_ctx *new_ctx, struct cpu_ctx *cur_ctx);
 int         _save_exec_state(struct lthread *lt);
 void        _lthread_compute_add(struct lthread *lt);
+void        _lthread_migrate_push(struct lthread *lt);
+void        _lthread_admit_release(struct lthread_sched *sched);
 void         _lthread_io_worker_init();
+void        _lthread_io_submit(struct lthread_io_req *req);
+void        _lthread_io_exec(struct lthread_io_req *req);
+ssize_t     _lthread_io_call(struct lthread_io_req *req);
+int         _lthread_io_open_has_mode(int flags);
+int         _lthread_uring_submit(struct lthread_sched *sched,
+    struct lthread_io_req *req);
+void        _lthread_uring_flush(struct lthread_sched *sched);
+void        _lthread_uring_reap(struct lthread_sched *sched);
+void        _lthread_uring_free(struct lthread_sched *sched);
+void        _lthread_future_hold(struct lthread_future *f);
+void        _lthread_log_sched_free(struct lthread_sched *sched);
+int         _lthread_compute_async(struct lthread_compute_pool *pool,
+    lthread_compute_fn fn, void *arg);
+
+int         _lthread_cpu_node(int cpu);
+int         _lthread_self_node(void);
+void        _lthread_numa_bind(void *addr, size_t len, int node);
 
 extern pthread_key_t lthread_sched_key;
 void print_timestamp(char *);
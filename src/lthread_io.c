@@ -26,47 +26,162 @@
  * lthread_io.c
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <assert.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
 #include "lthread_int.h"
+#include "lthread_affinity.h"
 
-#define IO_WORKERS 2
+#define IO_WORKERS 2            /* default number of io workers */
+#define LT_IO_MAX_WORKERS 64
+#define LT_IO_BATCH 64          /* requests a worker takes off its queue at once */
 
-static void _lthread_io_add(struct lthread *lt);
 static void *_lthread_io_worker(void *arg);
 
 static pthread_once_t key_once = PTHREAD_ONCE_INIT;
 
+TAILQ_HEAD(lthread_io_req_q, lthread_io_req);
+
 struct lthread_io_worker {
-    struct lthread_q    lthreads;
-    pthread_mutex_t     run_mutex;
-    pthread_cond_t      run_mutex_cond;
-    pthread_mutex_t     lthreads_mutex;
+    struct lthread_io_req_q reqs;
+    pthread_mutex_t     reqs_mutex;
+    pthread_cond_t      reqs_cond;
+    pthread_t           pthread;
+    int                 sleeping;       /* waiting on reqs_cond */
+    /* updated atomically, see lthread_io_stats() */
+    uint64_t            depth;          /* requests queued or running */
+    uint64_t            depth_max;
+    uint64_t            completed;
+    uint64_t            latency_total;
+    uint64_t            latency_max;
 };
 
-static struct lthread_io_worker io_workers[IO_WORKERS];
+static struct lthread_io_worker io_workers[LT_IO_MAX_WORKERS];
+static int io_nworkers = IO_WORKERS;    /* workers taking new requests */
+static int io_started = 0;              /* workers with a pthread */
 
-// 初始化两个io_worker的信息，并创建两个载有_lthread_io_worker的线程
-// 注：此函数在使用时只会被执行一次
+/* guards starting workers and the cpus they run on */
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cpu_set_t io_cpus;
+static int io_cpus_set = 0;
+static int io_workers_started = 0;
+
+/* starts workers up to n, with io_mutex held */
 static void
-once_routine(void)
+_lthread_io_start(int n)
 {
-    pthread_t pthread;
     struct lthread_io_worker *io_worker = NULL;
+    pthread_attr_t attr;
     int i = 0;
 
-    for (i = 0; i < IO_WORKERS; i++) {
+    assert(pthread_attr_init(&attr) == 0);
+    if (io_cpus_set)
+        assert(pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t),
+            &io_cpus) == 0);
+
+    for (i = io_started; i < n; i++) {
         io_worker = &io_workers[i];
 
-        assert(pthread_mutex_init(&io_worker->lthreads_mutex, NULL) == 0);
-        assert(pthread_mutex_init(&io_worker->run_mutex, NULL) == 0);
-        assert(pthread_create(&pthread,
-            NULL, _lthread_io_worker, io_worker) == 0);
-        TAILQ_INIT(&io_worker->lthreads);
+        assert(pthread_mutex_init(&io_worker->reqs_mutex, NULL) == 0);
+        assert(pthread_cond_init(&io_worker->reqs_cond, NULL) == 0);
+        TAILQ_INIT(&io_worker->reqs);
+        assert(pthread_create(&io_worker->pthread,
+            &attr, _lthread_io_worker, io_worker) == 0);
+    }
+    if (n > io_started)
+        __atomic_store_n(&io_started, n, __ATOMIC_RELEASE);
+    assert(pthread_attr_destroy(&attr) == 0);
+}
+
+// 初始化io_worker的信息，并创建载有_lthread_io_worker的线程
+// 注：此函数在使用时只会被执行一次
+static void
+once_routine(void)
+{
+    assert(pthread_mutex_lock(&io_mutex) == 0);
+    _lthread_io_start(io_nworkers);
+    io_workers_started = 1;
+    assert(pthread_mutex_unlock(&io_mutex) == 0);
+}
+
+/*
+ * Restricts io worker pthreads to `cpus`. Can be called before or after the
+ * workers are started.
+ */
+int
+lthread_io_set_cpus(const int *cpus, int ncpus)
+{
+    cpu_set_t set;
+    int i = 0;
+
+    if (_lthread_cpus_to_set(cpus, ncpus, &set) == -1)
+        return (-1);
+
+    assert(pthread_mutex_lock(&io_mutex) == 0);
+    io_cpus = set;
+    io_cpus_set = 1;
+    for (i = 0; i < io_started; i++)
+        pthread_setaffinity_np(io_workers[i].pthread, sizeof(cpu_set_t),
+            &set);
+    assert(pthread_mutex_unlock(&io_mutex) == 0);
+
+    return (0);
+}
+
+/*
+ * Sets how many io workers take requests, up to LT_IO_MAX_WORKERS (64).
+ * Growing starts the new workers right away if the pool is already up;
+ * shrinking leaves the extra workers idle once they drain their queues.
+ */
+int
+lthread_io_set_workers(int nworkers)
+{
+    if (nworkers < 1 || nworkers > LT_IO_MAX_WORKERS) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    assert(pthread_mutex_lock(&io_mutex) == 0);
+    if (io_workers_started)
+        _lthread_io_start(nworkers);
+    __atomic_store_n(&io_nworkers, nworkers, __ATOMIC_RELEASE);
+    assert(pthread_mutex_unlock(&io_mutex) == 0);
 
+    return (0);
+}
+
+/*
+ * Fills up to nstats entries, one per io worker started so far, and returns
+ * how many workers there are.
+ */
+int
+lthread_io_stats(struct lthread_io_stats *stats, int nstats)
+{
+    struct lthread_io_worker *io_worker = NULL;
+    int n = __atomic_load_n(&io_started, __ATOMIC_ACQUIRE);
+    int i = 0;
+
+    for (i = 0; i < n && i < nstats; i++) {
+        io_worker = &io_workers[i];
+        stats[i].depth = __atomic_load_n(&io_worker->depth, __ATOMIC_RELAXED);
+        stats[i].depth_max = __atomic_load_n(&io_worker->depth_max,
+            __ATOMIC_RELAXED);
+        stats[i].completed = __atomic_load_n(&io_worker->completed,
+            __ATOMIC_RELAXED);
+        stats[i].latency_usecs_total = __atomic_load_n(
+            &io_worker->latency_total, __ATOMIC_RELAXED);
+        stats[i].latency_usecs_max = __atomic_load_n(
+            &io_worker->latency_max, __ATOMIC_RELAXED);
     }
+
+    return (n);
 }
 
 void
@@ -75,84 +190,340 @@ _lthread_io_worker_init()
     assert(pthread_once(&key_once, once_routine) == 0);     // pthread_once和key_once保证once_routine函数只会被调用一次
 }
 
+static inline void
+_lthread_io_stat_max(uint64_t *max, uint64_t val)
+{
+    uint64_t cur = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+    while (val > cur && !__atomic_compare_exchange_n(max, &cur, val, 1,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* accounts for a finished request, before it's handed back */
+static void
+_lthread_io_done(struct lthread_io_worker *io_worker,
+    struct lthread_io_req *req)
+{
+    uint64_t latency = _lthread_diff_usecs(req->queued, _lthread_usec_now());
+
+    __atomic_add_fetch(&io_worker->completed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&io_worker->latency_total, latency, __ATOMIC_RELAXED);
+    _lthread_io_stat_max(&io_worker->latency_max, latency);
+    __atomic_sub_fetch(&io_worker->depth, 1, __ATOMIC_RELEASE);
+}
+
+/* runs the blocking syscall req describes, in the calling pthread */
+void
+_lthread_io_exec(struct lthread_io_req *req)
+{
+    switch (req->op) {
+    case LT_IO_READ:
+        req->ret = read(req->fd, req->buf, req->nbytes);
+        break;
+    case LT_IO_WRITE:
+        req->ret = write(req->fd, req->buf, req->nbytes);
+        break;
+    case LT_IO_PREAD:
+        req->ret = pread(req->fd, req->buf, req->nbytes, req->offset);
+        break;
+    case LT_IO_PWRITE:
+        req->ret = pwrite(req->fd, req->buf, req->nbytes, req->offset);
+        break;
+    case LT_IO_READV:
+        req->ret = readv(req->fd, req->iov, req->iovcnt);
+        break;
+    case LT_IO_WRITEV:
+        req->ret = writev(req->fd, req->iov, req->iovcnt);
+        break;
+    case LT_IO_FSYNC:
+        req->ret = fsync(req->fd);
+        break;
+    case LT_IO_FDATASYNC:
+        req->ret = fdatasync(req->fd);
+        break;
+    case LT_IO_OPEN:
+        req->ret = open(req->path, req->flags, req->mode);
+        break;
+    case LT_IO_STAT:
+        req->ret = stat(req->path, req->st);
+        break;
+    case LT_IO_FSTAT:
+        req->ret = fstat(req->fd, req->st);
+        break;
+    case LT_IO_CLOSE:
+        req->ret = close(req->fd);
+        break;
+    case LT_IO_UNLINK:
+        req->ret = unlink(req->path);
+        break;
+    case LT_IO_GETADDRINFO:
+        /* returns an EAI_* code, errno only matters for EAI_SYSTEM */
+        req->ret = getaddrinfo(req->path, req->service, req->hints, req->ai);
+        req->err = (req->ret == EAI_SYSTEM) ? errno : 0;
+        return;
+    default:
+        assert(0);
+    }
+    req->err = (req->ret == -1) ? errno : 0;
+}
+
+/*
+ * Writes batch[0] and the requests right behind it that continue it, same
+ * fd and, for pwrite, the next offset, with a single writev/pwritev.
+ * Plain writes are only merged on regular files: on a datagram socket or a
+ * pipe read in records, merging would change the message boundaries.
+ * Returns how many requests it took care of.
+ */
+static int
+_lthread_io_coalesce(struct lthread_io_req **batch, int n)
+{
+    struct iovec iov[LT_IO_BATCH];
+    struct lthread_io_req *req = batch[0];
+    off_t offset = req->offset + req->nbytes;
+    struct stat st;
+    ssize_t ret = 0;
+    int short_write = 0;
+    int i = 0, cnt = 1;
+
+    for (cnt = 1; cnt < n; cnt++) {
+        if (batch[cnt]->op != req->op || batch[cnt]->fd != req->fd)
+            break;
+        if (req->op == LT_IO_PWRITE && batch[cnt]->offset != offset)
+            break;
+        offset += batch[cnt]->nbytes;
+    }
+
+    if (cnt > 1 && req->op == LT_IO_WRITE &&
+        (fstat(req->fd, &st) == -1 || !S_ISREG(st.st_mode))) {
+        for (i = 0; i < cnt; i++)
+            _lthread_io_exec(batch[i]);
+        return (cnt);
+    }
+
+    if (cnt == 1) {
+        _lthread_io_exec(req);
+        return (1);
+    }
+
+    for (i = 0; i < cnt; i++) {
+        iov[i].iov_base = batch[i]->buf;
+        iov[i].iov_len = batch[i]->nbytes;
+    }
+    if (req->op == LT_IO_PWRITE)
+        ret = pwritev(req->fd, iov, cnt, req->offset);
+    else
+        ret = writev(req->fd, iov, cnt);
+
+    /* hand out what got written, rerun the rest after a short write */
+    for (i = 0; i < cnt; i++) {
+        if (ret <= 0 || short_write) {
+            _lthread_io_exec(batch[i]);
+            continue;
+        }
+        if ((size_t)ret < batch[i]->nbytes) {
+            batch[i]->ret = ret;
+            short_write = 1;
+        } else
+            batch[i]->ret = batch[i]->nbytes;
+        batch[i]->err = 0;
+        ret -= batch[i]->ret;
+    }
+
+    return (cnt);
+}
+
+/*
+ * Hands the parked lthreads of a batch back to their schedulers, taking each
+ * scheduler's defer lock and triggering its poller once for all of them.
+ */
+static void
+_lthread_io_resume(struct lthread **lts, int n)
+{
+    struct lthread_sched *sched = NULL;
+    int i = 0, j = 0;
+
+    for (i = 0; i < n; i++) {
+        if (lts[i] == NULL)
+            continue;
+        sched = lts[i]->sched;
+
+        /* resume it back on the  prev scheduler */
+        assert(pthread_mutex_lock(&sched->defer_mutex) == 0);
+        for (j = i; j < n; j++) {
+            if (lts[j] == NULL || lts[j]->sched != sched)
+                continue;
+            TAILQ_INSERT_TAIL(&sched->defer, lts[j], defer_next);       // io完成之后把lt注册到原sched的defer队列中
+            lts[j] = NULL;
+        }
+        assert(pthread_mutex_unlock(&sched->defer_mutex) == 0);
+
+        /* signal the prev scheduler in case it was sleeping in a poll */
+        _lthread_poller_ev_trigger(sched);   // 同compute一样，如果原调度器阻塞在epoll_wait上，此处的io完毕后应该它们及时醒过来
+    }
+}
+
 // io_worker上的主程序，类似compute sched的调度器
 // arg是某个io_worker的信息（结构体指针）
+// 每次取走队列中最多LT_IO_BATCH个请求，批量执行、批量唤醒
 static void *
 _lthread_io_worker(void *arg)
 {
     struct lthread_io_worker *io_worker = arg;
-    struct lthread *lt = NULL;
-
-    assert(pthread_once(&key_once, once_routine) == 0);     // 完成两个io_worker的信息初始化和线程创建工作，如果它们还没有被做过
+    struct lthread_io_req *batch[LT_IO_BATCH];
+    struct lthread *lts[LT_IO_BATCH];
+    struct lthread_io_req *req = NULL;
+    int n = 0, i = 0;
 
     while (1) {
 
-        while (1) {
-            assert(pthread_mutex_lock(&io_worker->lthreads_mutex) == 0);
-
-            /* we have no work to do, break and wait */
-            if (TAILQ_EMPTY(&io_worker->lthreads)) {
-                assert(pthread_mutex_unlock(&io_worker->lthreads_mutex) == 0);
-                break;
-            }
+        assert(pthread_mutex_lock(&io_worker->reqs_mutex) == 0);
+        /* we have no work to do, wait for _lthread_io_submit() */
+        io_worker->sleeping = 1;
+        while (TAILQ_EMPTY(&io_worker->reqs))
+            pthread_cond_wait(&io_worker->reqs_cond,
+                &io_worker->reqs_mutex);     // 暂时没有io工作要做，整个线程wait
+        io_worker->sleeping = 0;
+        for (n = 0; n < LT_IO_BATCH &&
+            (req = TAILQ_FIRST(&io_worker->reqs)) != NULL; n++) {
+            TAILQ_REMOVE(&io_worker->reqs, req, next);
+            batch[n] = req;
+        }
+        assert(pthread_mutex_unlock(&io_worker->reqs_mutex) == 0);
 
-            lt = TAILQ_FIRST(&io_worker->lthreads);
-            TAILQ_REMOVE(&io_worker->lthreads, lt, io_next);
+        for (i = 0; i < n; ) {
+            if (batch[i]->op == LT_IO_WRITE || batch[i]->op == LT_IO_PWRITE)
+                i += _lthread_io_coalesce(&batch[i], n - i);
+            else
+                _lthread_io_exec(batch[i++]);
+        }
 
-            assert(pthread_mutex_unlock(&io_worker->lthreads_mutex) == 0);
+        /* a request is gone once it's handed back, don't touch it after */
+        for (i = 0; i < n; i++) {
+            req = batch[i];
+            _lthread_io_done(io_worker, req);
+            lts[i] = req->lt;
+            /* nobody is parked on a detached request, just report it */
+            if (req->lt == NULL)
+                req->done(req);
+        }
+        _lthread_io_resume(lts, n);
+    }
 
-            if (lt->state & BIT(LT_ST_WAIT_IO_READ)) {
-                lt->io.ret = read(lt->io.fd, lt->io.buf, lt->io.nbytes);
-                lt->io.err = (lt->io.ret == -1) ? errno : 0;
-            } else if (lt->state & BIT(LT_ST_WAIT_IO_WRITE)) {
-                lt->io.ret = write(lt->io.fd, lt->io.buf, lt->io.nbytes);
-                lt->io.err = (lt->io.ret == -1) ? errno : 0;
-            } else
-                assert(0);
+}
 
-            /* resume it back on the  prev scheduler */
-            assert(pthread_mutex_lock(&lt->sched->defer_mutex) == 0);
-            TAILQ_INSERT_TAIL(&lt->sched->defer, lt, defer_next);       // io完成之后把lt注册到原sched的defer队列中
-            assert(pthread_mutex_unlock(&lt->sched->defer_mutex) == 0);
+/*
+ * Picks the worker with the fewest requests queued or running, so one slow
+ * request doesn't hold up the ones behind it while another worker idles.
+ * The scan starts at a rotating worker to spread ties.
+ */
+static struct lthread_io_worker *
+_lthread_io_pick(void)
+{
+    static uint32_t io_selector = 0;
+    struct lthread_io_worker *io_worker = NULL, *best = NULL;
+    int n = __atomic_load_n(&io_nworkers, __ATOMIC_ACQUIRE);
+    uint32_t start = __atomic_fetch_add(&io_selector, 1, __ATOMIC_RELAXED);
+    uint64_t depth = 0, best_depth = UINT64_MAX;
+    int i = 0;
 
-            /* signal the prev scheduler in case it was sleeping in a poll */
-            _lthread_poller_ev_trigger(lt->sched);   // 同compute一样，如果原调度器阻塞在epoll_wait上，此处的io完毕后应该它们及时醒过来              
+    for (i = 0; i < n; i++) {
+        io_worker = &io_workers[(start + i) % n];
+        depth = __atomic_load_n(&io_worker->depth, __ATOMIC_ACQUIRE);
+        if (depth == 0)
+            return (io_worker);
+        if (depth < best_depth) {
+            best = io_worker;
+            best_depth = depth;
         }
+    }
+
+    return (best);
+}
+
+/*
+ * Queues req on the least loaded io worker and wakes it up. The caller must
+ * keep req alive until the worker resumes req->lt or calls req->done.
+ */
+void
+_lthread_io_submit(struct lthread_io_req *req)
+{
+    struct lthread_io_worker *io_worker = NULL;
+    uint64_t depth = 0;
 
-        assert(pthread_mutex_lock(&io_worker->run_mutex) == 0);
-        pthread_cond_wait(&io_worker->run_mutex_cond,
-            &io_worker->run_mutex);         // 暂时没有io工作要做，整个线程wait
-        assert(pthread_mutex_unlock(&io_worker->run_mutex) == 0);
+    _lthread_io_worker_init();
+    io_worker = _lthread_io_pick();
 
-    }
+    req->queued = _lthread_usec_now();
+    depth = __atomic_add_fetch(&io_worker->depth, 1, __ATOMIC_ACQ_REL);
+    _lthread_io_stat_max(&io_worker->depth_max, depth);
 
+    assert(pthread_mutex_lock(&io_worker->reqs_mutex) == 0);
+    TAILQ_INSERT_TAIL(&io_worker->reqs, req, next);
+    /* wakeup pthread if it was sleeping, a busy one drains the queue anyway */
+    if (io_worker->sleeping)
+        assert(pthread_cond_signal(&io_worker->reqs_cond) == 0);
+    assert(pthread_mutex_unlock(&io_worker->reqs_mutex) == 0);
 }
 
 // 被普通的协程执行，将其上的某个lt放进busy队列，并注册到一个io_worker线程上，
 // 如果该io_worker处于睡眠状态（没有任务而wait中）就唤醒它；注册完毕后yield
-static void
-_lthread_io_add(struct lthread *lt)
+static ssize_t
+_lthread_io_add(struct lthread *lt, struct lthread_io_req *req)
 {
-    static uint32_t io_selector = 0;
-    struct lthread_io_worker *io_worker = &io_workers[io_selector++];
-    io_selector = io_selector % IO_WORKERS;
-
+    req->lt = lt;
     LIST_INSERT_HEAD(&lt->sched->busy, lt, busy_next);
-
-    assert(pthread_mutex_lock(&io_worker->lthreads_mutex) == 0);
-    TAILQ_INSERT_TAIL(&io_worker->lthreads, lt, io_next);
-    assert(pthread_mutex_unlock(&io_worker->lthreads_mutex) == 0);
-
-    /* wakeup pthread if it was sleeping */
-    assert(pthread_mutex_lock(&io_worker->run_mutex) == 0);
-    assert(pthread_cond_signal(&io_worker->run_mutex_cond) == 0);
-    assert(pthread_mutex_unlock(&io_worker->run_mutex) == 0);
+    /* the scheduler's io_uring if it has one, else an io worker */
+    if (_lthread_uring_submit(lt->sched, req) == -1)
+        _lthread_io_submit(req);
 
     _lthread_yield(lt);
 
     /* restore errno we got from io worker, if any */
-    if (lt->io.ret == -1)       // 从io_worker执行回来后，检查一下io是否成功
-        errno = lt->io.err;
+    if (req->ret == -1)       // 从io_worker执行回来后，检查一下io是否成功
+        errno = req->err;
+
+    return (req->ret);
+}
+
+/*
+ * Runs req off the scheduler and parks the calling lthread until it's done.
+ * Outside an lthread there is nothing to park, the call just blocks.
+ */
+ssize_t
+_lthread_io_call(struct lthread_io_req *req)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt = sched ? sched->current_lthread : NULL;
+    enum lthread_st st = LT_ST_WAIT_IO_READ;
+    ssize_t ret = 0;
+
+    if (lt == NULL) {
+        _lthread_io_exec(req);
+        if (req->ret == -1)
+            errno = req->err;
+        return (req->ret);
+    }
+
+    switch (req->op) {
+    case LT_IO_WRITE:
+    case LT_IO_PWRITE:
+    case LT_IO_WRITEV:
+    case LT_IO_FSYNC:
+    case LT_IO_FDATASYNC:
+    case LT_IO_CLOSE:
+    case LT_IO_UNLINK:
+        st = LT_ST_WAIT_IO_WRITE;
+        break;
+    default:
+        break;
+    }
+
+    lt->state |= BIT(st);
+    ret = _lthread_io_add(lt, req);
+    lt->state &= CLEARBIT(st);
+
+    return (ret);
 }
 
 // 被普通协程执行，会调用_thread_io_add将自己放到一个io_worker线程上去做io；tests/lthread_io.c中示范了lthread_io_write的使用
@@ -160,16 +531,14 @@ _lthread_io_add(struct lthread *lt)
 ssize_t
 lthread_io_read(int fd, void *buf, size_t nbytes)
 {
-    struct lthread *lt = lthread_get_sched()->current_lthread;
-    lt->state |= BIT(LT_ST_WAIT_IO_READ);
-    lt->io.buf = buf;
-    lt->io.fd = fd;
-    lt->io.nbytes = nbytes;
+    struct lthread_io_req req = {0};
 
-    _lthread_io_add(lt);
-    lt->state &= CLEARBIT(LT_ST_WAIT_IO_READ);
+    req.op = LT_IO_READ;
+    req.buf = buf;
+    req.fd = fd;
+    req.nbytes = nbytes;
 
-    return (lt->io.ret);
+    return (_lthread_io_call(&req));
 }
 
 // 被普通协程执行，会调用_thread_io_add将自己放到一个io_worker线程上去做io；tests/lthread_io.c中示范了lthread_io_write的使用
@@ -177,14 +546,166 @@ lthread_io_read(int fd, void *buf, size_t nbytes)
 ssize_t
 lthread_io_write(int fd, void *buf, size_t nbytes)
 {
-    struct lthread *lt = lthread_get_sched()->current_lthread;
-    lt->state |= BIT(LT_ST_WAIT_IO_WRITE);
-    lt->io.buf = buf;
-    lt->io.nbytes = nbytes;
-    lt->io.fd = fd;
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_WRITE;
+    req.buf = buf;
+    req.nbytes = nbytes;
+    req.fd = fd;
+
+    return (_lthread_io_call(&req));
+}
+
+/*
+ * The calls below mirror their syscalls, running them off the scheduler
+ * like lthread_io_read/write.
+ */
+ssize_t
+lthread_io_pread(int fd, void *buf, size_t nbytes, off_t offset)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_PREAD;
+    req.fd = fd;
+    req.buf = buf;
+    req.nbytes = nbytes;
+    req.offset = offset;
+
+    return (_lthread_io_call(&req));
+}
+
+ssize_t
+lthread_io_pwrite(int fd, const void *buf, size_t nbytes, off_t offset)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_PWRITE;
+    req.fd = fd;
+    req.buf = (void *)buf;
+    req.nbytes = nbytes;
+    req.offset = offset;
+
+    return (_lthread_io_call(&req));
+}
+
+ssize_t
+lthread_io_readv(int fd, const struct iovec *iov, int iovcnt)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_READV;
+    req.fd = fd;
+    req.iov = iov;
+    req.iovcnt = iovcnt;
+
+    return (_lthread_io_call(&req));
+}
+
+ssize_t
+lthread_io_writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_WRITEV;
+    req.fd = fd;
+    req.iov = iov;
+    req.iovcnt = iovcnt;
+
+    return (_lthread_io_call(&req));
+}
+
+int
+lthread_io_fsync(int fd)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_FSYNC;
+    req.fd = fd;
+
+    return (_lthread_io_call(&req));
+}
+
+int
+lthread_io_fdatasync(int fd)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_FDATASYNC;
+    req.fd = fd;
+
+    return (_lthread_io_call(&req));
+}
+
+/*
+ * True when open(2) takes a mode for these flags. O_TMPFILE includes the
+ * O_DIRECTORY bit, so testing it with a plain `&` would match O_DIRECTORY.
+ */
+int
+_lthread_io_open_has_mode(int flags)
+{
+    return ((flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE);
+}
+
+int
+lthread_io_open(const char *path, int flags, ...)
+{
+    struct lthread_io_req req = {0};
+    va_list ap;
+
+    req.op = LT_IO_OPEN;
+    req.path = path;
+    req.flags = flags;
+    if (_lthread_io_open_has_mode(flags)) {
+        va_start(ap, flags);
+        req.mode = va_arg(ap, int);
+        va_end(ap);
+    }
+
+    return (_lthread_io_call(&req));
+}
+
+int
+lthread_io_stat(const char *path, struct stat *st)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_STAT;
+    req.path = path;
+    req.st = st;
+
+    return (_lthread_io_call(&req));
+}
+
+int
+lthread_io_fstat(int fd, struct stat *st)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_FSTAT;
+    req.fd = fd;
+    req.st = st;
+
+    return (_lthread_io_call(&req));
+}
+
+int
+lthread_io_close(int fd)
+{
+    struct lthread_io_req req = {0};
+
+    req.op = LT_IO_CLOSE;
+    req.fd = fd;
+
+    return (_lthread_io_call(&req));
+}
+
+int
+lthread_io_unlink(const char *path)
+{
+    struct lthread_io_req req = {0};
 
-    _lthread_io_add(lt);
-    lt->state &= CLEARBIT(LT_ST_WAIT_IO_WRITE);
+    req.op = LT_IO_UNLINK;
+    req.path = path;
 
-    return (lt->io.ret);
+    return (_lthread_io_call(&req));
 }
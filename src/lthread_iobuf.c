@@ -0,0 +1,228 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * lthread_iobuf.c
+ *
+ * Pools of aligned buffers for O_DIRECT io. Direct io wants the buffer, the
+ * file offset and the length aligned to the device's block size; a pool
+ * carves equally sized aligned buffers out of one allocation up front and
+ * lends them out, so lthreads don't posix_memalign() per request. When the
+ * pool runs dry borrowers wait for a buffer to be returned, which also
+ * bounds how much io is in flight.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lthread_int.h"
+
+#define LT_IO_BUF_ALIGN (4096)
+
+/* a borrower queued on an empty pool, the next returned buffer is its */
+struct lthread_io_buf_waiter {
+    struct lthread_future *f;
+    TAILQ_ENTRY(lthread_io_buf_waiter) next;
+};
+
+struct lthread_io_buf_pool {
+    pthread_mutex_t     mutex;
+    char                *slab;          /* every buffer, back to back */
+    size_t              size;           /* per buffer, a multiple of align */
+    size_t              nbufs;
+    void                **free;         /* stack of buffers not lent out */
+    size_t              nfree;
+    TAILQ_HEAD(, lthread_io_buf_waiter) waiters;
+    uint64_t            borrowed;
+    uint64_t            waited;
+};
+
+/*
+ * Creates a pool of nbufs buffers of at least size bytes each, aligned to
+ * align bytes (0 for 4096, which suits every common block device).
+ */
+int
+lthread_io_buf_pool_create(struct lthread_io_buf_pool **pool, size_t size,
+    size_t nbufs, size_t align)
+{
+    struct lthread_io_buf_pool *p = NULL;
+    size_t i = 0;
+
+    if (align == 0)
+        align = LT_IO_BUF_ALIGN;
+    if (size == 0 || nbufs == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    if ((p = calloc(1, sizeof(struct lthread_io_buf_pool))) == NULL)
+        return (-1);
+    p->size = (size + align - 1) & ~(align - 1);
+    p->nbufs = nbufs;
+    if ((p->free = calloc(nbufs, sizeof(void *))) == NULL)
+        goto err;
+    if ((errno = posix_memalign((void **)&p->slab, align,
+        p->size * nbufs)) != 0) {
+        p->slab = NULL;
+        goto err;
+    }
+
+    for (i = 0; i < nbufs; i++)
+        p->free[i] = p->slab + (nbufs - i - 1) * p->size;
+    p->nfree = nbufs;
+    TAILQ_INIT(&p->waiters);
+    assert(pthread_mutex_init(&p->mutex, NULL) == 0);
+    *pool = p;
+
+    return (0);
+
+err:
+    free(p->free);
+    free(p);
+    return (-1);
+}
+
+/*
+ * Borrows a buffer from the pool. If all are lent out the caller queues up
+ * and is handed a buffer as soon as one is returned, first come first
+ * served.
+ */
+void *
+lthread_io_buf_get(struct lthread_io_buf_pool *pool)
+{
+    struct lthread_io_buf_waiter w;
+    void *buf = NULL;
+
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    pool->borrowed++;
+    if (pool->nfree > 0) {
+        buf = pool->free[--pool->nfree];
+        assert(pthread_mutex_unlock(&pool->mutex) == 0);
+        return (buf);
+    }
+
+    if (lthread_future_create(&w.f) == -1) {
+        assert(pthread_mutex_unlock(&pool->mutex) == 0);
+        return (NULL);
+    }
+    /* one reference for us, one for whoever hands us the buffer */
+    _lthread_future_hold(w.f);
+    TAILQ_INSERT_TAIL(&pool->waiters, &w, next);
+    pool->waited++;
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+
+    lthread_future_wait(w.f, 0);
+    buf = lthread_future_result(w.f);
+    lthread_future_free(w.f);
+
+    return (buf);
+}
+
+/* hands buf back to the pool it was borrowed from */
+void
+lthread_io_buf_put(struct lthread_io_buf_pool *pool, void *buf)
+{
+    struct lthread_io_buf_waiter *w = NULL;
+    struct lthread_future *f = NULL;
+
+    assert((char *)buf >= pool->slab &&
+        (char *)buf < pool->slab + pool->size * pool->nbufs &&
+        ((char *)buf - pool->slab) % pool->size == 0);
+
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    if ((w = TAILQ_FIRST(&pool->waiters)) != NULL) {
+        /* w lives on the waiter's stack, done with it once unlinked */
+        TAILQ_REMOVE(&pool->waiters, w, next);
+        f = w->f;
+    } else {
+        assert(pool->nfree < pool->nbufs);
+        pool->free[pool->nfree++] = buf;
+    }
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+
+    if (f != NULL) {
+        lthread_future_set(f, buf, 0);
+        lthread_future_free(f);
+    }
+}
+
+size_t
+lthread_io_buf_size(struct lthread_io_buf_pool *pool)
+{
+    return (pool->size);
+}
+
+void
+lthread_io_buf_pool_stats(struct lthread_io_buf_pool *pool,
+    struct lthread_io_buf_stats *stats)
+{
+    assert(pthread_mutex_lock(&pool->mutex) == 0);
+    stats->bufs = pool->nbufs;
+    stats->free = pool->nfree;
+    stats->borrowed = pool->borrowed;
+    stats->waited = pool->waited;
+    assert(pthread_mutex_unlock(&pool->mutex) == 0);
+}
+
+/* every buffer must have been returned */
+void
+lthread_io_buf_pool_free(struct lthread_io_buf_pool *pool)
+{
+    assert(pool->nfree == pool->nbufs && TAILQ_EMPTY(&pool->waiters));
+    assert(pthread_mutex_destroy(&pool->mutex) == 0);
+    free(pool->slab);
+    free(pool->free);
+    free(pool);
+}
+
+/*
+ * Opens path for direct io, bypassing the page cache. Reads and writes on
+ * the fd need buffers from an lthread_io_buf_pool, and offsets and lengths
+ * that are multiples of the pool's alignment. Filesystems without direct
+ * io support (tmpfs, some fuse mounts) fail with EINVAL.
+ */
+int
+lthread_io_open_direct(const char *path, int flags, ...)
+{
+    va_list ap;
+    int mode = 0;
+
+    if (_lthread_io_open_has_mode(flags)) {
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+
+    return (lthread_io_open(path, flags | O_DIRECT, mode));
+}
@@ -0,0 +1,497 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * lthread_log.c
+ *
+ * Buffered logging that never blocks a scheduler on the log file. Each
+ * scheduler copies messages into its own single producer ring; a flusher
+ * pthread drains every ring with one writev() whenever a ring fills past
+ * flush_bytes, every flush_interval msecs, on lthread_log_flush() and at
+ * exit. pthreads without a scheduler share a ring behind a mutex.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lthread_int.h"
+
+enum {
+    LT_LOG_RING_SIZE = 64 * 1024,
+    LT_LOG_INTERVAL = 100,              /* msecs */
+    LT_LOG_LINE_MAX = 1024,             /* lthread_log() formats on the stack */
+    LT_LOG_MAX_RINGS = 512              /* rings drained per writev */
+};
+
+struct lthread_log_ring {
+    char                *buf;
+    size_t              size;           /* power of 2 */
+    uint64_t            head;           /* moved by the producer */
+    uint64_t            tail;           /* moved by the flusher */
+    int                 closed;         /* owner is gone, free once drained */
+    LIST_ENTRY(lthread_log_ring) next;
+};
+
+LIST_HEAD(lthread_log_ring_l, lthread_log_ring);
+
+/* log_mutex guards the ring list and the flusher's state */
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static struct lthread_log_ring_l log_rings = LIST_HEAD_INITIALIZER(log_rings);
+static struct lthread_log_config log_config;
+static int log_fd = -1;
+static int log_running = 0;
+static int log_stopping = 0;
+static int log_kicked = 0;
+static int log_atexit = 0;
+static pthread_t log_flusher;
+static struct lthread_future *log_flush_next = NULL;
+
+/* ring shared by pthreads without a scheduler, e.g. compute workers */
+static pthread_mutex_t log_shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct lthread_log_ring *log_shared = NULL;
+
+static uint64_t log_written = 0;
+static uint64_t log_dropped = 0;
+static uint64_t log_flushes = 0;
+static uint64_t log_bytes = 0;
+
+static struct lthread_log_ring *
+_lthread_log_ring_new(void)
+{
+    struct lthread_log_ring *ring = NULL;
+
+    if ((ring = calloc(1, sizeof(struct lthread_log_ring))) == NULL)
+        return (NULL);
+    ring->size = log_config.ring_size;
+    if ((ring->buf = malloc(ring->size)) == NULL) {
+        free(ring);
+        return (NULL);
+    }
+
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    LIST_INSERT_HEAD(&log_rings, ring, next);
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+
+    return (ring);
+}
+
+static void
+_lthread_log_ring_free(struct lthread_log_ring *ring)
+{
+    LIST_REMOVE(ring, next);
+    free(ring->buf);
+    free(ring);
+}
+
+/* wakes the flusher up unless it's already been asked to run */
+static void
+_lthread_log_kick(void)
+{
+    if (__atomic_exchange_n(&log_kicked, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    assert(pthread_cond_signal(&log_cond) == 0);
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+}
+
+/* copies buf in, only ever called by the ring's producer */
+static int
+_lthread_log_append(struct lthread_log_ring *ring, const void *buf,
+    size_t nbytes)
+{
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t off = head & (ring->size - 1);
+    size_t first = ring->size - off;
+
+    if (ring->size - (head - tail) < nbytes)
+        return (-1);
+
+    if (first > nbytes)
+        first = nbytes;
+    memcpy(ring->buf + off, buf, first);
+    memcpy(ring->buf, (const char *)buf + first, nbytes - first);
+    __atomic_store_n(&ring->head, head + nbytes, __ATOMIC_RELEASE);
+
+    if (head + nbytes - tail >= log_config.flush_bytes)
+        _lthread_log_kick();
+
+    return (0);
+}
+
+static void
+_lthread_log_writev(struct iovec *iov, int cnt)
+{
+    ssize_t ret = 0;
+
+    while (cnt > 0) {
+        ret = writev(log_fd, iov, cnt > IOV_MAX ? IOV_MAX : cnt);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret == -1)
+            break;
+        __atomic_add_fetch(&log_bytes, ret, __ATOMIC_RELAXED);
+        while (cnt > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    /* the log file is broken, what's left is lost */
+    for (; cnt > 0; cnt--, iov++)
+        __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Writes out what every ring holds. Called by the flusher with log_mutex
+ * held; the mutex is dropped around the writev so producers registering a
+ * ring or kicking us don't wait on the disk.
+ */
+static void
+_lthread_log_drain(void)
+{
+    static struct iovec iov[LT_LOG_MAX_RINGS * 2];
+    static struct lthread_log_ring *rings[LT_LOG_MAX_RINGS];
+    static uint64_t heads[LT_LOG_MAX_RINGS];
+    struct lthread_log_ring *ring = NULL, *ring_tmp = NULL;
+    size_t off = 0, len = 0;
+    int n = 0, cnt = 0, i = 0;
+
+    LIST_FOREACH(ring, &log_rings, next) {
+        if (n == LT_LOG_MAX_RINGS) {
+            /* come back for the rest right away */
+            __atomic_store_n(&log_kicked, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        heads[n] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (heads[n] == ring->tail)
+            continue;
+
+        off = ring->tail & (ring->size - 1);
+        len = heads[n] - ring->tail;
+        iov[cnt].iov_base = ring->buf + off;
+        iov[cnt].iov_len = (off + len > ring->size) ? ring->size - off : len;
+        if (iov[cnt].iov_len < len) {
+            iov[cnt + 1].iov_base = ring->buf;
+            iov[cnt + 1].iov_len = len - iov[cnt].iov_len;
+            cnt++;
+        }
+        cnt++;
+        rings[n++] = ring;
+    }
+
+    if (cnt > 0) {
+        /* only we free rings, the snapshot stays valid unlocked */
+        assert(pthread_mutex_unlock(&log_mutex) == 0);
+        _lthread_log_writev(iov, cnt);
+        assert(pthread_mutex_lock(&log_mutex) == 0);
+        __atomic_add_fetch(&log_flushes, 1, __ATOMIC_RELAXED);
+    }
+
+    for (i = 0; i < n; i++)
+        __atomic_store_n(&rings[i]->tail, heads[i], __ATOMIC_RELEASE);
+
+    LIST_FOREACH_SAFE(ring, &log_rings, next, ring_tmp)
+        if (ring->closed &&
+            ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+            _lthread_log_ring_free(ring);
+}
+
+static void *
+_lthread_log_flusher(void *arg)
+{
+    struct lthread_future *waiters = NULL;
+    struct timespec ts;
+    int stopping = 0;
+    (void)arg;
+
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    while (!stopping) {
+        if (!__atomic_load_n(&log_kicked, __ATOMIC_ACQUIRE) &&
+            log_flush_next == NULL && !log_stopping) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += log_config.flush_interval / 1000;
+            ts.tv_nsec += (log_config.flush_interval % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&log_cond, &log_mutex, &ts);
+        }
+
+        /* drain once more after we were told to stop */
+        stopping = log_stopping;
+        __atomic_store_n(&log_kicked, 0, __ATOMIC_RELEASE);
+        waiters = log_flush_next;
+        log_flush_next = NULL;
+
+        _lthread_log_drain();
+
+        if (waiters != NULL) {
+            lthread_future_set(waiters, NULL, 0);
+            lthread_future_free(waiters);
+        }
+    }
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+
+    return (NULL);
+}
+
+/*
+ * Starts logging to fd. config may be NULL for the defaults: 64k rings
+ * flushed once half full or every 100 msecs, dropping messages that don't
+ * fit. lthread_log_close() runs at exit to flush what's left.
+ */
+int
+lthread_log_init(int fd, const struct lthread_log_config *config)
+{
+    size_t size = LT_LOG_RING_SIZE;
+
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    if (log_running) {
+        assert(pthread_mutex_unlock(&log_mutex) == 0);
+        errno = EBUSY;
+        return (-1);
+    }
+
+    memset(&log_config, 0, sizeof(log_config));
+    if (config != NULL)
+        log_config = *config;
+    if (log_config.ring_size)
+        for (size = 1; size < log_config.ring_size; size <<= 1)
+            ;
+    log_config.ring_size = size;
+    if (log_config.flush_bytes == 0 || log_config.flush_bytes > size)
+        log_config.flush_bytes = size / 2;
+    if (log_config.flush_interval == 0)
+        log_config.flush_interval = LT_LOG_INTERVAL;
+    log_fd = fd;
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+
+    assert(pthread_mutex_lock(&log_shared_mutex) == 0);
+    if (log_shared == NULL && (log_shared = _lthread_log_ring_new()) == NULL) {
+        assert(pthread_mutex_unlock(&log_shared_mutex) == 0);
+        return (-1);
+    }
+    assert(pthread_mutex_unlock(&log_shared_mutex) == 0);
+
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    if (pthread_create(&log_flusher, NULL, _lthread_log_flusher, NULL) != 0) {
+        assert(pthread_mutex_unlock(&log_mutex) == 0);
+        return (-1);
+    }
+    log_running = 1;
+    if (!log_atexit)
+        log_atexit = (atexit(lthread_log_close) == 0);
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+
+    return (0);
+}
+
+/* waits for the flusher to make room, or says why it can't */
+static int
+_lthread_log_full(struct lthread_sched *sched, int shared)
+{
+    if (log_config.policy == LTHREAD_LOG_DROP || !log_running) {
+        __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+        errno = ENOBUFS;
+        return (-1);
+    }
+
+    _lthread_log_kick();
+    if (shared)
+        assert(pthread_mutex_unlock(&log_shared_mutex) == 0);
+    if (sched != NULL && sched->current_lthread != NULL)
+        lthread_usleep(100);
+    else
+        sched_yield();
+    if (shared)
+        assert(pthread_mutex_lock(&log_shared_mutex) == 0);
+
+    return (0);
+}
+
+/*
+ * Queues nbytes of buf for the log file. Messages from one scheduler reach
+ * the file in order and whole. Fails with ENOBUFS if the ring is full under
+ * LTHREAD_LOG_DROP, and EMSGSIZE if buf can never fit.
+ */
+int
+lthread_log_write(const void *buf, size_t nbytes)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread_log_ring *ring = NULL;
+    int ret = 0;
+
+    if (log_fd == -1) {
+        errno = EINVAL;
+        return (-1);
+    }
+    if (nbytes > log_config.ring_size) {
+        errno = EMSGSIZE;
+        return (-1);
+    }
+
+    if (sched == NULL) {
+        assert(pthread_mutex_lock(&log_shared_mutex) == 0);
+        while ((ret = _lthread_log_append(log_shared, buf, nbytes)) == -1 &&
+            _lthread_log_full(NULL, 1) == 0)
+            ;
+        assert(pthread_mutex_unlock(&log_shared_mutex) == 0);
+    } else {
+        if (sched->log_ring == NULL &&
+            (sched->log_ring = _lthread_log_ring_new()) == NULL)
+            return (-1);
+        ring = sched->log_ring;
+        while ((ret = _lthread_log_append(ring, buf, nbytes)) == -1 &&
+            _lthread_log_full(sched, 0) == 0)
+            ;
+    }
+
+    if (ret == 0)
+        __atomic_add_fetch(&log_written, 1, __ATOMIC_RELAXED);
+
+    return (ret);
+}
+
+/* printf(3) into the log, messages longer than 1k are truncated */
+int
+lthread_log(const char *fmt, ...)
+{
+    char line[LT_LOG_LINE_MAX];
+    va_list ap;
+    int n = 0;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return (-1);
+    if (n >= (int)sizeof(line))
+        n = sizeof(line) - 1;
+
+    return (lthread_log_write(line, n));
+}
+
+/*
+ * Returns once everything logged before the call is written to the log
+ * file. The calling lthread parks meanwhile.
+ */
+int
+lthread_log_flush(void)
+{
+    struct lthread_future *f = NULL;
+
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    if (!log_running) {
+        assert(pthread_mutex_unlock(&log_mutex) == 0);
+        errno = EINVAL;
+        return (-1);
+    }
+    if (log_flush_next == NULL &&
+        lthread_future_create(&log_flush_next) == -1) {
+        assert(pthread_mutex_unlock(&log_mutex) == 0);
+        return (-1);
+    }
+    f = log_flush_next;
+    _lthread_future_hold(f);
+    assert(pthread_cond_signal(&log_cond) == 0);
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+
+    lthread_future_wait(f, 0);
+    lthread_future_free(f);
+
+    return (0);
+}
+
+/*
+ * Flushes everything and stops the flusher. Called at exit, or explicitly
+ * before closing the log fd; lthread_log_init() can start it again.
+ */
+void
+lthread_log_close(void)
+{
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    if (!log_running || log_stopping) {
+        assert(pthread_mutex_unlock(&log_mutex) == 0);
+        return;
+    }
+    log_stopping = 1;
+    assert(pthread_cond_signal(&log_cond) == 0);
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+
+    assert(pthread_join(log_flusher, NULL) == 0);
+
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    log_running = 0;
+    log_stopping = 0;
+    log_fd = -1;
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+}
+
+void
+lthread_log_stats(struct lthread_log_stats *stats)
+{
+    stats->written = __atomic_load_n(&log_written, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+    stats->flushes = __atomic_load_n(&log_flushes, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&log_bytes, __ATOMIC_RELAXED);
+}
+
+/* the scheduler is going away, its ring goes once the flusher drained it */
+void
+_lthread_log_sched_free(struct lthread_sched *sched)
+{
+    struct lthread_log_ring *ring = sched->log_ring;
+
+    if (ring == NULL)
+        return;
+
+    sched->log_ring = NULL;
+    assert(pthread_mutex_lock(&log_mutex) == 0);
+    ring->closed = 1;
+    if (!log_running)
+        _lthread_log_ring_free(ring);
+    assert(pthread_mutex_unlock(&log_mutex) == 0);
+    if (log_running)
+        _lthread_log_kick();
+}
@@ -52,6 +52,7 @@ void _lthread_poller_ev_clear_rd(int fd);
 void _lthread_poller_ev_register_trigger(void);
 void _lthread_poller_ev_trigger(struct lthread_sched *sched);
 void _lthread_poller_ev_clear_trigger(void);
+void _lthread_poller_ev_clear_timer(void);
 void _lthread_poller_set_fd_ready(struct lthread *lt, int fd,
     enum lthread_event, int is_eof);
 
@@ -73,15 +73,18 @@ RB_GENERATE(lthread_rb_wait, lthread, wait_node, _lthread_wait_cmp); // 生成 w
 
 static uint64_t _lthread_min_timeout(struct lthread_sched *);
 
-static int  _lthread_poll(void);
+static int  _lthread_poll(uint64_t max_usecs);
+static void _lthread_run_iteration(struct lthread_sched *sched,
+    uint64_t max_usecs);
 static void _lthread_resume_expired(struct lthread_sched *sched);
+static void _lthread_migrate_adopt(struct lthread_sched *sched);
 static inline int _lthread_sched_isdone(struct lthread_sched *sched);
 
 static struct lthread find_lt;
 
 // 大致上是对调度器中的POLL_EVENT_TYPE事件进行轮询，用得到的事件数去设置调度器的相关参数【有些地方还不太明白】
 static int
-_lthread_poll(void)
+_lthread_poll(uint64_t max_usecs)
 {
     struct lthread_sched *sched;
     sched = lthread_get_sched();    // 获取当前lthread所属的调度器
@@ -91,21 +94,22 @@ _lthread_poll(void)
 
     sched->num_new_events = 0;
     usecs = _lthread_min_timeout(sched);
+    if (usecs > max_usecs)
+        usecs = max_usecs;
 
-    /* never sleep if we have an lthread pending in the new queue */
+    /*
+     * never sleep if we have an lthread pending in the new queue, or if the
+     * last lthread just exited and nothing is left to wake us up.
+     */
     // 如果_lthread_min_timeout返回0，或者就绪队列不为空，就直接返回，不会继续去获取POLL_EVENT_TYPE事件
-    if (usecs && TAILQ_EMPTY(&sched->ready)) {
-        // 【感觉这一段应该就是把微秒转换成秒+纳秒，但好像逻辑又不完全对】
-        t.tv_sec =  usecs / 1000000u;   
-        if (t.tv_sec != 0)              
-            t.tv_nsec  =  (usecs % 1000u)  * 1000000u;  // 【就是这里，貌似写错了？——经讨论，是作者把两个数字写反了】
-        else
-            t.tv_nsec = usecs * 1000u;
-    } else {
-        return 0;               
-        t.tv_nsec = 0;
-        t.tv_sec = 0;
+    if (usecs && TAILQ_EMPTY(&sched->ready) && !_lthread_sched_isdone(sched)) {
+        t.tv_sec = usecs / 1000000u;
+        t.tv_nsec = (usecs % 1000000u) * 1000u;
     }
+    /*
+     * otherwise poll without blocking. Skipping the poll would starve
+     * events for as long as lthreads keep the ready queue busy.
+     */
 
     // 不断尝试获取就绪的POLL_EVENT_TYPE事件，直到获取成功
     while (1) {
@@ -121,6 +125,9 @@ _lthread_poll(void)
 
     sched->nevents = 0;         // 【？】
     sched->num_new_events = ret;
+    sched->stats_events += ret;
+    if ((uint64_t)ret > sched->stats_events_max)
+        sched->stats_events_max = ret;
 
     return (0);
 }
@@ -159,113 +166,298 @@ _lthread_sched_isdone(struct lthread_sched *sched)        // 【defer没有判
     return (RB_EMPTY(&sched->waiting) &&
         LIST_EMPTY(&sched->busy) &&
         RB_EMPTY(&sched->sleeping) &&
-        TAILQ_EMPTY(&sched->ready));
+        TAILQ_EMPTY(&sched->ready) &&
+        TAILQ_EMPTY(&sched->migrate));
 }
 
-// 核心调度循环
-void
-lthread_run(void)
+/*
+ * Returns 1 if the ready queue pass that started at `start` and resumed
+ * `nready` lthreads used up the scheduler's budget. At least one lthread
+ * runs per pass so a tiny time budget can't stall the scheduler.
+ */
+static inline int
+_lthread_budget_exhausted(struct lthread_sched *sched, uint32_t nready,
+    uint64_t start)
+{
+    if (nready == 0)
+        return (0);
+
+    if (sched->ready_budget && nready >= sched->ready_budget)
+        return (1);
+
+    if (sched->ready_budget_usecs &&
+        _lthread_diff_usecs(start, _lthread_usec_now()) >=
+        sched->ready_budget_usecs)
+        return (1);
+
+    return (0);
+}
+
+static inline void
+_lthread_ready_stats(struct lthread_sched *sched, uint32_t nready,
+    uint64_t start)
+{
+    uint64_t usecs = _lthread_diff_usecs(start, _lthread_usec_now());
+
+    sched->stats_ready_resumed += nready;
+    if (nready > sched->stats_ready_max)
+        sched->stats_ready_max = nready;
+    if (usecs > sched->stats_ready_usecs_max)
+        sched->stats_ready_usecs_max = usecs;
+}
+
+/*
+ * Bounds the number of ready lthreads (max_lthreads) and/or the time
+ * (max_usecs) a single scheduler iteration spends on the ready queue before
+ * it polls for new events. 0 means no limit for either.
+ */
+int
+lthread_sched_set_budget(uint32_t max_lthreads, uint64_t max_usecs)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+
+    if (sched == NULL) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    sched->ready_budget = max_lthreads;
+    sched->ready_budget_usecs = max_usecs;
+
+    return (0);
+}
+
+/*
+ * Enables (the default) or disables epoll_pwait2 for sub-msec timeouts in
+ * the calling pthread's scheduler. When disabled, or if the kernel lacks
+ * it, a timerfd covers the sub-msec part of the wait instead.
+ */
+int
+lthread_sched_set_pwait2(int enable)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+
+    if (sched == NULL) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    sched->no_pwait2 = !enable;
+
+    return (0);
+}
+
+/*
+ * One pass of the scheduler: resumes expired lthreads, the ready queue,
+ * lthreads back from compute/io and those migrated to us, then polls for
+ * events blocking at most max_usecs and resumes the lthreads they belong to.
+ */
+static void
+_lthread_run_iteration(struct lthread_sched *sched, uint64_t max_usecs)
 {
-    struct lthread_sched *sched;
     struct lthread *lt = NULL;
-    struct lthread *lt_read = NULL, *lt_write = NULL, *lt_last_ready = NULL;
+    struct lthread *lt_read = NULL, *lt_write = NULL;
     int p = 0;
     int fd = 0;
     int is_eof = 0;
+    uint32_t nready = 0;
+    uint64_t ready_start = 0;
 
-    sched = lthread_get_sched();
-    /* scheduler not initiliazed, and no lthreads where created */
-    if (sched == NULL)
-        return;
+    /* 1. start by checking if a sleeping thread（指lthread） needs to wakeup */ 
+    _lthread_resume_expired(sched);
+
+    /* 2. check to see if we have any ready threads to run.
+     * if new lthreads got added to the ready queue in process, they'll
+     * run the next time we get here again.
+     */
+    sched->stats_iterations++;
+    ready_start = _lthread_usec_now();
+    nready = 0;
+    sched->ready_last = TAILQ_LAST(&sched->ready, lthread_q);
+    /* lthread_migrate() moves ready_last back, or clears it to end the pass */
+    while (sched->ready_last != NULL) {
+        /* leave the rest for the next iteration, after a poll */
+        if (_lthread_budget_exhausted(sched, nready, ready_start)) {
+            sched->stats_budget_exhausted++;
+            break;
+        }
+        lt = TAILQ_FIRST(&sched->ready);
+        TAILQ_REMOVE(&lt->sched->ready, lt, ready_next);
+        _lthread_resume(lt);
+        nready++;
+        if (lt == sched->ready_last)    // 因此，在执行这些lthread的过程中，如果新push了某个lthread，它不会在此次循环被执行
+            break;
+    }
+    sched->ready_last = NULL;
+    _lthread_ready_stats(sched, nready, ready_start);
+
+    /* 3. resume lthreads we received from lthread_compute, if any */
+    while (!TAILQ_EMPTY(&sched->defer)) {
+        assert(pthread_mutex_lock(&sched->defer_mutex) == 0);
+        lt = TAILQ_FIRST(&sched->defer);
+        if (lt == NULL) {
+            assert(pthread_mutex_unlock(&sched->defer_mutex) == 0);
+            break;
+        }
+        TAILQ_REMOVE(&sched->defer, lt, defer_next);
+        assert(pthread_mutex_unlock(&sched->defer_mutex) == 0);
+        LIST_REMOVE(lt, busy_next);
+        /* a future waiter may also be on the sleeping tree for its timeout */
+        _lthread_desched_sleep(lt);
+        _lthread_resume(lt);
+    }
+
+    /* take in lthreads other schedulers migrated to us */
+    if (!TAILQ_EMPTY(&sched->migrate))
+        _lthread_migrate_adopt(sched);
+
+    /* submit the file io lthreads queued on our ring in this pass */
+    if (sched->uring != NULL)
+        _lthread_uring_flush(sched);
 
-    while (!_lthread_sched_isdone(sched)) {
+    /* 4. check if we received any events after lthread_poll */
+    _lthread_poll(max_usecs);    // 就绪事件的个数设置在了num_new_events中，在第5步中使用；就绪事件的列表由epoll_wait写在sched->event_list中
 
-        /* 1. start by checking if a sleeping thread（指lthread） needs to wakeup */ 
-        _lthread_resume_expired(sched);
+    /* resume lthreads whose file io completed, they signal our eventfd */
+    if (sched->uring != NULL)
+        _lthread_uring_reap(sched);
 
-        /* 2. check to see if we have any ready threads to run.
-         * if new lthreads got added to the ready queue in process, they'll
-         * run the next time we get here again.
+    /* 5. fire up lthreads that are ready to run */
+    while (sched->num_new_events) {
+        p = --sched->num_new_events;
+
+        fd = _lthread_poller_ev_get_fd(&sched->eventlist[p]);   // 获取和就绪事件相关的那个文件描述符
+
+        /* 
+         * We got signaled via trigger to wakeup from polling & rusume file io.
+         * Those lthreads will get handled in step 4.
          */
-        lt_last_ready = TAILQ_LAST(&sched->ready, lthread_q);
-        while (!TAILQ_EMPTY(&sched->ready)) {
-            lt = TAILQ_FIRST(&sched->ready);
-            TAILQ_REMOVE(&lt->sched->ready, lt, ready_next);
-            _lthread_resume(lt);
-            if (lt == lt_last_ready)        // 因此，在执行这些lthread的过程中，如果新push了某个lthread，它不会在此次循环被执行
-                break;
+        if (fd == sched->eventfd) {    // 调度器本身记录了一个fd，作为一个触发器【触发器的用途暂不清楚】，这个fd也会被添加到epoll实例的事件集合中
+            _lthread_poller_ev_clear_trigger(); // 清除触发器就是对fd进行一次读操作
+            continue;
         }
 
-        /* 3. resume lthreads we received from lthread_compute, if any */
-        while (!TAILQ_EMPTY(&sched->defer)) {
-            assert(pthread_mutex_lock(&sched->defer_mutex) == 0);
-            lt = TAILQ_FIRST(&sched->defer);
-            if (lt == NULL) {
-                assert(pthread_mutex_unlock(&sched->defer_mutex) == 0);
-                break;
-            }
-            TAILQ_REMOVE(&sched->defer, lt, defer_next);
-            assert(pthread_mutex_unlock(&sched->defer_mutex) == 0);
-            LIST_REMOVE(lt, busy_next);
-            _lthread_resume(lt);
+        /* the poller's sub-msec timer fired, expired lthreads run in step 1 */
+        if (sched->timerfd != -1 && fd == sched->timerfd) {
+            _lthread_poller_ev_clear_timer();
+            continue;
         }
 
-        /* 4. check if we received any events after lthread_poll */
-        _lthread_poll();    // 就绪事件的个数设置在了num_new_events中，在第5步中使用；就绪事件的列表由epoll_wait写在sched->event_list中
-
-        /* 5. fire up lthreads that are ready to run */
-        while (sched->num_new_events) {
-            p = --sched->num_new_events;
-
-            fd = _lthread_poller_ev_get_fd(&sched->eventlist[p]);   // 获取和就绪事件相关的那个文件描述符
-
-            /* 
-             * We got signaled via trigger to wakeup from polling & rusume file io.
-             * Those lthreads will get handled in step 4.
-             */
-            if (fd == sched->eventfd) {    // 调度器本身记录了一个fd，作为一个触发器【触发器的用途暂不清楚】，这个fd也会被添加到epoll实例的事件集合中
-                _lthread_poller_ev_clear_trigger(); // 清除触发器就是对fd进行一次读操作
-                continue;
-            }
-
-            is_eof = _lthread_poller_ev_is_eof(&sched->eventlist[p]);  // 若事件为：对应的文件描述符被挂断了
-            if (is_eof)
-                errno = ECONNRESET;
-
-        #define HANDLE_EV(lt_wr, ev)                                                \
-            lt_wr = _lthread_desched_event(fd, ev);  /* 将lt从sleeping tree或者waiting tree中移除 */ \
-            if (lt_wr != NULL) {                                                    \
-                                                                                    \
-                if (!(lt_wr->state & BIT(LT_ST_WAIT_MULTI))) {                      \
-                    if (is_eof)                                                     \
-                        lt_wr->state |= BIT(LT_ST_FDEOF);                           \
-                    _lthread_resume(lt_wr);                                         \
-                } else {    /* 如果lt监听着多个fd，这些fd式借助poll的数据结构记录的 */                                                        \
-                    /*                                                              \
-                     * this lthread was waiting on multiple events, increment       \
-                     * ready_fds and place it on the ready queue to resume after we \
-                     * finished counting all ready fds that the lthread was waiting \
-                     * on. This is to emulate poll(2) return call.                  \
-                     */                                                             \
-                    if (lt_wr->ready_fds == 0)   /* ready_fds不为0说明刚刚INSERT过了*/                                   \
-                        TAILQ_INSERT_TAIL(&sched->ready, lt_wr, ready_next);    /* 当然，要在下一轮才会执行，或者说执行完set_fd_ready之后回到调度循环开头时 */        \
-                    _lthread_poller_set_fd_ready(lt_wr, fd, ev, is_eof);  /* 配合lthread_poll（定义在socket.c中）使用，对poll监听做出相应的处理 */          \
-                }                                                                   \
-            }                                                                       \
-
-            HANDLE_EV(lt_read, LT_EV_READ);
-            HANDLE_EV(lt_write, LT_EV_WRITE);
-            is_eof = 0;
-
-            assert(lt_write != NULL || lt_read != NULL);
-        }
+        is_eof = _lthread_poller_ev_is_eof(&sched->eventlist[p]);  // 若事件为：对应的文件描述符被挂断了
+        if (is_eof)
+            errno = ECONNRESET;
+
+    #define HANDLE_EV(lt_wr, ev)                                                \
+        lt_wr = _lthread_desched_event(fd, ev);  /* 将lt从sleeping tree或者waiting tree中移除 */ \
+        if (lt_wr != NULL) {                                                    \
+                                                                                \
+            if (!(lt_wr->state & BIT(LT_ST_WAIT_MULTI))) {                      \
+                if (is_eof)                                                     \
+                    lt_wr->state |= BIT(LT_ST_FDEOF);                           \
+                _lthread_resume(lt_wr);                                         \
+            } else {    /* 如果lt监听着多个fd，这些fd式借助poll的数据结构记录的 */                                                        \
+                /*                                                              \
+                 * this lthread was waiting on multiple events, increment       \
+                 * ready_fds and place it on the ready queue to resume after we \
+                 * finished counting all ready fds that the lthread was waiting \
+                 * on. This is to emulate poll(2) return call.                  \
+                 */                                                             \
+                if (lt_wr->ready_fds == 0)   /* ready_fds不为0说明刚刚INSERT过了*/                                   \
+                    TAILQ_INSERT_TAIL(&sched->ready, lt_wr, ready_next);    /* 当然，要在下一轮才会执行，或者说执行完set_fd_ready之后回到调度循环开头时 */        \
+                _lthread_poller_set_fd_ready(lt_wr, fd, ev, is_eof);  /* 配合lthread_poll（定义在socket.c中）使用，对poll监听做出相应的处理 */          \
+            }                                                                   \
+        }                                                                       \
+
+        HANDLE_EV(lt_read, LT_EV_READ);
+        HANDLE_EV(lt_write, LT_EV_WRITE);
+        is_eof = 0;
+
+        assert(lt_write != NULL || lt_read != NULL);
     }
+}
+
+// 核心调度循环
+void
+lthread_run(void)
+{
+    struct lthread_sched *sched;
+
+    sched = lthread_get_sched();
+    /* scheduler not initiliazed, and no lthreads where created */
+    if (sched == NULL)
+        return;
+
+    while (!_lthread_sched_isdone(sched))
+        _lthread_run_iteration(sched, sched->default_timeout);
 
     _sched_free(sched);
 
     return;
 }
 
+/*
+ * Runs a single scheduler iteration, blocking in the poller for at most
+ * `timeout` msecs, for embedding lthreads in a foreign event loop. Unlike
+ * lthread_run() it doesn't free the scheduler once it's done; call
+ * lthread_run() to do so. Returns 1 if the scheduler has more work, 0 if
+ * it's done, or -1 if there is no scheduler in this pthread.
+ */
+int
+lthread_run_once(uint64_t timeout)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+
+    if (sched == NULL)
+        return (-1);
+
+    if (!_lthread_sched_isdone(sched))
+        _lthread_run_iteration(sched, timeout * 1000u);
+
+    return (!_lthread_sched_isdone(sched));
+}
+
+/*
+ * Returns the scheduler's poller fd. It becomes readable when lthread_run_once()
+ * has events to process, including completions from compute/io pthreads.
+ */
+int
+lthread_sched_poller_fd(void)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+
+    return (sched ? sched->poller_fd : -1);
+}
+
+/*
+ * Returns how many msecs a foreign event loop can wait on the poller fd
+ * before calling lthread_run_once() again: 0 if lthreads are ready, or the
+ * time left until the next lthread expires, rounded up. -1 if there is no
+ * timer pending and only an event can wake lthreads up.
+ */
+int
+lthread_sched_timeout(void)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt = NULL;
+    uint64_t now = 0;
+
+    if (sched == NULL)
+        return (-1);
+
+    if (!TAILQ_EMPTY(&sched->ready) || !TAILQ_EMPTY(&sched->defer) ||
+        !TAILQ_EMPTY(&sched->migrate))
+        return (0);
+
+    if ((lt = RB_MIN(lthread_rb_sleep, &sched->sleeping)) == NULL)
+        return (-1);
+
+    now = _lthread_diff_usecs(sched->birth, _lthread_usec_now());
+    if (lt->sleep_usecs <= now)
+        return (0);
+
+    return ((lt->sleep_usecs - now + 999u) / 1000u);
+}
+
 /*
  * Cancels registered event in poller and deschedules (fd, ev) -> lt from
  * rbtree. This is safe to be called even if the lthread wasn't waiting on an
@@ -321,6 +513,17 @@ _lthread_desched_event(int fd, enum lthread_event e)
 void
 _lthread_sched_event(struct lthread *lt, int fd, enum lthread_event e,
     uint64_t timeout)
+{
+    _lthread_sched_event_us(lt, fd, e,
+        timeout == -1 ? timeout : timeout * 1000u);
+}
+
+/*
+ * Same as _lthread_sched_event() with the timeout in usecs.
+ */
+void
+_lthread_sched_event_us(struct lthread *lt, int fd, enum lthread_event e,
+    uint64_t timeout)
 {
     struct lthread *lt_tmp = NULL;
     enum lthread_st st;
@@ -346,7 +549,7 @@ _lthread_sched_event(struct lthread *lt, int fd, enum lthread_event e,
     assert(lt_tmp == NULL);
     if (timeout == -1)
         return;
-    _lthread_sched_sleep(lt, timeout);
+    _lthread_sched_sleep_us(lt, timeout);
     lt->fd_wait = -1;
     lt->state &= CLEARBIT(st);
 }
@@ -374,17 +577,22 @@ _lthread_desched_sleep(struct lthread *lt)
  */
 void
 _lthread_sched_sleep(struct lthread *lt, uint64_t msecs)
+{
+    _lthread_sched_sleep_us(lt, msecs * 1000u);
+}
+
+void
+_lthread_sched_sleep_us(struct lthread *lt, uint64_t usecs)
 {
     struct lthread *lt_tmp = NULL;
-    uint64_t usecs = msecs * 1000u;
 
     /*
-     * if msecs is 0, we won't schedule lthread otherwise loop until
+     * if usecs is 0, we won't schedule lthread otherwise loop until
      * collision resolved(very rare) by incrementing usec++.
      */
     // 【lfr】为什么不直接用now()+usecs，这样后面也用now()比较，非得减去birth??
     lt->sleep_usecs = _lthread_diff_usecs(lt->sched->birth, _lthread_usec_now()) + usecs;   
-    while (msecs) {
+    while (usecs) {
         lt_tmp = RB_INSERT(lthread_rb_sleep, &lt->sched->sleeping, lt);
         if (lt_tmp) {
             lt->sleep_usecs++;
@@ -396,7 +604,7 @@ _lthread_sched_sleep(struct lthread *lt, uint64_t msecs)
 
 
     _lthread_yield(lt);
-    if (msecs > 0)
+    if (usecs > 0)
         lt->state &= CLEARBIT(LT_ST_SLEEPING);
 
     lt->sleep_usecs = 0;
@@ -404,11 +612,17 @@ _lthread_sched_sleep(struct lthread *lt, uint64_t msecs)
 
 void
 _lthread_sched_busy_sleep(struct lthread *lt, uint64_t msecs)
+{
+    _lthread_sched_busy_sleep_us(lt, msecs * 1000u);
+}
+
+void
+_lthread_sched_busy_sleep_us(struct lthread *lt, uint64_t usecs)
 {
 
     LIST_INSERT_HEAD(&lt->sched->busy, lt, busy_next);
     lt->state |= BIT(LT_ST_BUSY);
-    _lthread_sched_sleep(lt, msecs);
+    _lthread_sched_sleep_us(lt, usecs);
     lt->state &= CLEARBIT(LT_ST_BUSY);
     LIST_REMOVE(lt, busy_next);
 }
@@ -444,3 +658,194 @@ _lthread_resume_expired(struct lthread_sched *sched)
         break;
     }
 }
+
+struct lthread_sched *
+lthread_sched_self(void)
+{
+    return (lthread_get_sched());
+}
+
+/*
+ * Queues lt on the scheduler it's migrating to and wakes that scheduler up.
+ * Called from the source scheduler once lt is off its ready queue and trees
+ * and not running; lt must not be touched by the caller afterwards.
+ */
+void
+_lthread_migrate_push(struct lthread *lt)
+{
+    struct lthread_sched *target = lt->migrate_sched;
+
+    /* deadlines travel as absolute time, schedulers have their own birth */
+    if (lt->state & BIT(LT_ST_SLEEPING))
+        lt->sleep_usecs += lt->sched->birth;
+    lt->state &= CLEARBIT(LT_ST_EXPIRED);
+    /* the source may be gone by the time the target adopts lt */
+    lt->migrate_node = lt->sched->numa_node;
+    /* the stack counts against the target's lthread limit from now on */
+    _lthread_admit_release(lt->sched);
+
+    assert(pthread_mutex_lock(&target->defer_mutex) == 0);
+    TAILQ_INSERT_TAIL(&target->migrate, lt, ready_next);
+    assert(pthread_mutex_unlock(&target->defer_mutex) == 0);
+
+    _lthread_poller_ev_trigger(target);
+}
+
+/*
+ * Re-attaches lthreads migrated to sched: restores their deadline in the
+ * sleeping tree and their fd interest in our poller, or makes them ready.
+ */
+static void
+_lthread_migrate_adopt(struct lthread_sched *sched)
+{
+    struct lthread_q migrated;
+    struct lthread *lt = NULL;
+    struct lthread *lt_tmp = NULL;
+
+    TAILQ_INIT(&migrated);
+    assert(pthread_mutex_lock(&sched->defer_mutex) == 0);
+    TAILQ_CONCAT(&migrated, &sched->migrate, ready_next);
+    assert(pthread_mutex_unlock(&sched->defer_mutex) == 0);
+
+    while ((lt = TAILQ_FIRST(&migrated)) != NULL) {
+        TAILQ_REMOVE(&migrated, lt, ready_next);
+
+        if (sched->numa_node != lt->migrate_node)
+            _lthread_numa_bind(lt->stack, lt->stack_size, sched->numa_node);
+        lt->sched = sched;
+        lt->migrate_sched = NULL;
+        sched->live_lthreads++;
+        lt->state &= CLEARBIT(LT_ST_PENDING_MIGRATE);
+
+        if (lt->state & BIT(LT_ST_SLEEPING)) {
+            if (lt->sleep_usecs > sched->birth)
+                lt->sleep_usecs -= sched->birth;
+            else
+                lt->sleep_usecs = 0;
+            while (RB_INSERT(lthread_rb_sleep, &sched->sleeping, lt))
+                lt->sleep_usecs++;
+        }
+
+        if (lt->migrate_wait) {
+            lt->migrate_wait = 0;
+            if (lt->state & BIT(LT_ST_WAIT_READ))
+                _lthread_poller_ev_register_rd(FD_ONLY(lt->fd_wait));
+            else
+                _lthread_poller_ev_register_wr(FD_ONLY(lt->fd_wait));
+            lt_tmp = RB_INSERT(lthread_rb_wait, &sched->waiting, lt);
+            assert(lt_tmp == NULL);
+        } else if (!(lt->state & BIT(LT_ST_SLEEPING))) {
+            TAILQ_INSERT_TAIL(&sched->ready, lt, ready_next);
+        }
+    }
+}
+
+/*
+ * An lthread with a joiner, or blocked on anything but a single fd or a
+ * sleep, is tied to its scheduler and can't be moved.
+ */
+static int
+_lthread_migrate_busy(struct lthread *lt)
+{
+    return (lt->lt_join ||
+        lt->state & (BIT(LT_ST_BUSY) | BIT(LT_ST_WAIT_MULTI) |
+        BIT(LT_ST_EXITED) | BIT(LT_ST_CANCELLED) |
+        BIT(LT_ST_PENDING_RUNCOMPUTE) | BIT(LT_ST_RUNCOMPUTE) |
+        BIT(LT_ST_WAIT_IO_READ) | BIT(LT_ST_WAIT_IO_WRITE) |
+        BIT(LT_ST_PENDING_MIGRATE) | BIT(LT_ST_ADMIT_QUEUED) |
+        BIT(LT_ST_WAIT_COMPUTE) | BIT(LT_ST_WAIT_FUTURE)));
+}
+
+/*
+ * Moves the current lthread to `target`. Returns once lthread runs in the
+ * target scheduler, or EBUSY if someone is joining it.
+ */
+int
+lthread_migrate_self(struct lthread_sched *target)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt = sched->current_lthread;
+
+    if (target == NULL) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    if (target == sched)
+        return (0);
+
+    /* our exit would hand the joiner to target's ready queue */
+    if (_lthread_migrate_busy(lt)) {
+        errno = EBUSY;
+        return (-1);
+    }
+
+    lt->migrate_sched = target;
+    lt->state |= BIT(LT_ST_PENDING_MIGRATE);
+    _lthread_yield(lt);
+
+    return (0);
+}
+
+/*
+ * Moves lt from the current scheduler to `target`, which may run in another
+ * pthread. lt must belong to the current scheduler and be either ready,
+ * sleeping or waiting on a single fd; lthreads blocked in join, cond, poll,
+ * io or compute, or with a joiner, can't be moved and EBUSY is returned.
+ * `target` must keep running lthread_run() until lt is adopted.
+ */
+int
+lthread_migrate(struct lthread *lt, struct lthread_sched *target)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt_tmp = NULL;
+
+    if (target == NULL || lt->sched != sched) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    if (target == sched)
+        return (0);
+
+    if (_lthread_migrate_busy(lt)) {
+        errno = EBUSY;
+        return (-1);
+    }
+
+    if (lt == sched->current_lthread)
+        return (lthread_migrate_self(target));
+
+    /*
+     * an lthread woken up by lthread_close() still carries its wait state
+     * but sits in the ready queue, only trust the waiting tree.
+     */
+    if (lt->fd_wait >= 0) {
+        find_lt.fd_wait = lt->fd_wait;
+        lt_tmp = RB_FIND(lthread_rb_wait, &sched->waiting, &find_lt);
+    }
+
+    if (lt_tmp == lt) {
+        RB_REMOVE(lthread_rb_wait, &sched->waiting, lt);
+        if (lt->state & BIT(LT_ST_WAIT_READ))
+            _lthread_poller_ev_clear_rd(FD_ONLY(lt->fd_wait));
+        else
+            _lthread_poller_ev_clear_wr(FD_ONLY(lt->fd_wait));
+        lt->migrate_wait = 1;
+    }
+
+    if (lt->state & BIT(LT_ST_SLEEPING))
+        RB_REMOVE(lthread_rb_sleep, &sched->sleeping, lt);
+    else if (!lt->migrate_wait) {
+        /* don't take the current ready pass's end marker with us */
+        if (lt == sched->ready_last)
+            sched->ready_last = TAILQ_PREV(lt, lthread_q, ready_next);
+        TAILQ_REMOVE(&sched->ready, lt, ready_next);
+    }
+
+    lt->migrate_sched = target;
+    lt->state |= BIT(LT_ST_PENDING_MIGRATE);
+    _lthread_migrate_push(lt);
+
+    return (0);
+}
@@ -26,6 +26,9 @@
  * lthread_socket.c
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include <errno.h>
 #include <unistd.h>
@@ -40,6 +43,10 @@
 #include <fcntl.h>
 #include <netinet/in.h>
 
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 #include "lthread_int.h"
 
 #if defined(__FreeBSD__) || defined(__APPLE__)
@@ -48,12 +55,17 @@
     #define FLAG | MSG_NOSIGNAL
 #endif
 
-// fd, timeout_ms是函数参数，event为LT_EV_READ或者LT_EV_WRITE
+#define LT_SPLICE_CHUNK (64 * 1024)
+
+/* negative msecs keep meaning "register the event but don't wait" */
+#define MS_TO_US(ms) ((ms) < 0 ? (uint64_t)-1 : (uint64_t)(ms) * 1000u)
+
+// fd, timeout_us是函数参数，event为LT_EV_READ或者LT_EV_WRITE
 #define LTHREAD_WAIT(fn, event)                                 \
 fn                                                              \
 {                                                               \
     struct lthread *lt = lthread_get_sched()->current_lthread;  \
-    _lthread_sched_event(lt, fd, event, timeout_ms);            \
+    _lthread_sched_event_us(lt, fd, event, timeout_us);         \
     if (lt->state & BIT(LT_ST_FDEOF))                           \
         return (-1);                                            \
     if (lt->state & BIT(LT_ST_EXPIRED))                         \
@@ -62,6 +74,7 @@ fn                                                              \
 }
 
 // 用于封装read族和recv族的接口，但是为什么使用while？
+/* timeout is in usecs, the msec variants below convert */
 #define LTHREAD_RECV(x, y)                                  \
 x {                                                         \
     ssize_t ret = 0;                                        \
@@ -74,7 +87,7 @@ x {                                                         \
         if (ret == -1 && errno != EAGAIN)                   \
             return (-1);                                    \
         if ((ret == -1 && errno == EAGAIN)) {               \
-            _lthread_sched_event(lt, fd, LT_EV_READ, timeout);  \
+            _lthread_sched_event_us(lt, fd, LT_EV_READ, timeout); \
             if (lt->state & BIT(LT_ST_EXPIRED))             \
                 return (-2);                                \
         }                                                   \
@@ -103,7 +116,7 @@ x {                                                         \
         if (ret == -1 && errno != EAGAIN)                   \
             return (-1);                                    \
         if ((ret == -1 && errno == EAGAIN)) {               \
-            _lthread_sched_event(lt, fd, LT_EV_READ, timeout); \
+            _lthread_sched_event_us(lt, fd, LT_EV_READ, timeout); \
             if (lt->state & BIT(LT_ST_EXPIRED))             \
                 return (-2);                                \
         }                                                   \
@@ -312,48 +325,99 @@ err:
     return (ret);
 }
 
-LTHREAD_WAIT(int lthread_wait_read(int fd, int timeout_ms), LT_EV_READ);    // lthread_wait_read和lthread_wait_write测试样例中好像都没有
-LTHREAD_WAIT(int lthread_wait_write(int fd, int timeout_ms), LT_EV_WRITE);
+LTHREAD_WAIT(int lthread_wait_read_us(int fd, uint64_t timeout_us), LT_EV_READ);    // lthread_wait_read和lthread_wait_write测试样例中好像都没有
+LTHREAD_WAIT(int lthread_wait_write_us(int fd, uint64_t timeout_us), LT_EV_WRITE);
+
+int
+lthread_wait_read(int fd, int timeout_ms)
+{
+    return (lthread_wait_read_us(fd, MS_TO_US(timeout_ms)));
+}
+
+int
+lthread_wait_write(int fd, int timeout_ms)
+{
+    return (lthread_wait_write_us(fd, MS_TO_US(timeout_ms)));
+}
 
 // 封装recv
 LTHREAD_RECV(
-    ssize_t lthread_recv(int fd, void *buf, size_t length, int flags,
+    ssize_t lthread_recv_us(int fd, void *buf, size_t length, int flags,
         uint64_t timeout),
     recv(fd, buf, length, flags FLAG)
 )
 
 // 封装read
 LTHREAD_RECV(
-    ssize_t lthread_read(int fd, void *buf, size_t length, uint64_t timeout),
+    ssize_t lthread_read_us(int fd, void *buf, size_t length, uint64_t timeout),
     read(fd, buf, length)
 )
 
 LTHREAD_RECV_EXACT(
-    ssize_t lthread_recv_exact(int fd, void *buf, size_t length, int flags,
+    ssize_t lthread_recv_exact_us(int fd, void *buf, size_t length, int flags,
         uint64_t timeout),
     recv(fd, buf + recvd, length - recvd, flags FLAG)
 )
 
 LTHREAD_RECV_EXACT(
-    ssize_t lthread_read_exact(int fd, void *buf, size_t length,
+    ssize_t lthread_read_exact_us(int fd, void *buf, size_t length,
         uint64_t timeout),
     read(fd, buf + recvd, length - recvd)
 )
 
 // 封装recvmsg
 LTHREAD_RECV(
-    ssize_t lthread_recvmsg(int fd, struct msghdr *message, int flags,
+    ssize_t lthread_recvmsg_us(int fd, struct msghdr *message, int flags,
         uint64_t timeout),
     recvmsg(fd, message, flags FLAG)
 )
 
 // 封装recvfrom
 LTHREAD_RECV(
-    ssize_t lthread_recvfrom(int fd, void *buf, size_t length, int flags,
+    ssize_t lthread_recvfrom_us(int fd, void *buf, size_t length, int flags,
         struct sockaddr *address, socklen_t *address_len, uint64_t timeout),
     recvfrom(fd, buf, length, flags FLAG, address, address_len)
 )
 
+ssize_t
+lthread_recv(int fd, void *buf, size_t length, int flags, uint64_t timeout)
+{
+    return (lthread_recv_us(fd, buf, length, flags, timeout * 1000u));
+}
+
+ssize_t
+lthread_read(int fd, void *buf, size_t length, uint64_t timeout)
+{
+    return (lthread_read_us(fd, buf, length, timeout * 1000u));
+}
+
+ssize_t
+lthread_recv_exact(int fd, void *buf, size_t length, int flags,
+    uint64_t timeout)
+{
+    return (lthread_recv_exact_us(fd, buf, length, flags, timeout * 1000u));
+}
+
+ssize_t
+lthread_read_exact(int fd, void *buf, size_t length, uint64_t timeout)
+{
+    return (lthread_read_exact_us(fd, buf, length, timeout * 1000u));
+}
+
+ssize_t
+lthread_recvmsg(int fd, struct msghdr *message, int flags, uint64_t timeout)
+{
+    return (lthread_recvmsg_us(fd, message, flags, timeout * 1000u));
+}
+
+ssize_t
+lthread_recvfrom(int fd, void *buf, size_t length, int flags,
+    struct sockaddr *address, socklen_t *address_len, uint64_t timeout)
+{
+    return (lthread_recvfrom_us(fd, buf, length, flags, address, address_len,
+        timeout * 1000u));
+}
+
 // 封装send
 LTHREAD_SEND(
     ssize_t lthread_send(int fd, const void *buf, size_t length, int flags),
@@ -384,6 +448,13 @@ int
 lthread_connect(int fd, struct sockaddr *name, socklen_t namelen,
     uint64_t timeout)
 {
+    return (lthread_connect_us(fd, name, namelen, timeout * 1000u));
+}
+
+int
+lthread_connect_us(int fd, struct sockaddr *name, socklen_t namelen,
+    uint64_t timeout)
+{
 
     int ret = 0;
     struct lthread *lt = lthread_get_sched()->current_lthread;
@@ -396,7 +467,7 @@ lthread_connect(int fd, struct sockaddr *name, socklen_t namelen,
         if (ret == -1 && (errno == EAGAIN || 
             errno == EWOULDBLOCK ||
             errno == EINPROGRESS)) {
-            _lthread_sched_event(lt, fd, LT_EV_WRITE, timeout);
+            _lthread_sched_event_us(lt, fd, LT_EV_WRITE, timeout);
             if (lt->state & BIT(LT_ST_EXPIRED))
                 return (-2);
             
@@ -471,6 +542,125 @@ lthread_sendfile(int fd, int s, off_t offset, size_t nbytes,
 
     } while (1);
 }
+#elif defined(__linux__)
+/*
+ * Sends nbytes of file fd starting at offset to socket s without copying
+ * through userspace. Returns the bytes sent, fewer if the file ends first.
+ */
+ssize_t
+lthread_sendfile(int fd, int s, off_t offset, size_t nbytes)
+{
+    ssize_t ret = 0;
+    size_t sent = 0;
+    struct lthread *lt = lthread_get_sched()->current_lthread;
+
+    while (sent != nbytes) {
+        if (lt->state & BIT(LT_ST_FDEOF))
+            return (-1);
+        _lthread_renice(lt);
+        ret = sendfile(s, fd, &offset, nbytes - sent);
+        if (ret == 0)
+            break;
+        if (ret > 0)
+            sent += ret;
+        if (ret == -1 && errno != EAGAIN)
+            return (-1);
+        if (ret == -1 && errno == EAGAIN)
+            _lthread_sched_event(lt, s, LT_EV_WRITE, 0);
+    }
+
+    return (sent);
+}
+
+/* empty pipes kept by the scheduler for lthread_splice() */
+static int
+_lthread_splice_pipe(struct lthread_sched *sched, int p[2])
+{
+    if (sched->nsplice_pipes > 0) {
+        sched->nsplice_pipes--;
+        p[0] = sched->splice_pipes[sched->nsplice_pipes][0];
+        p[1] = sched->splice_pipes[sched->nsplice_pipes][1];
+        return (0);
+    }
+
+    return (pipe2(p, O_NONBLOCK | O_CLOEXEC));
+}
+
+static void
+_lthread_splice_pipe_put(struct lthread_sched *sched, int p[2], size_t inpipe)
+{
+    /* leftover bytes would end up in someone else's stream */
+    if (inpipe == 0 && sched->nsplice_pipes < LT_SPLICE_PIPES) {
+        sched->splice_pipes[sched->nsplice_pipes][0] = p[0];
+        sched->splice_pipes[sched->nsplice_pipes][1] = p[1];
+        sched->nsplice_pipes++;
+        return;
+    }
+
+    close(p[0]);
+    close(p[1]);
+}
+
+/*
+ * Moves up to len bytes from fd_in to fd_out through a pipe, so the data
+ * never reaches userspace; meant for proxying between two sockets. Returns
+ * the bytes moved, fewer than len once fd_in hits EOF.
+ */
+ssize_t
+lthread_splice(int fd_in, int fd_out, size_t len)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+    struct lthread *lt = sched->current_lthread;
+    ssize_t ret = 0;
+    size_t moved = 0, inpipe = 0;
+    int p[2];
+
+    if (_lthread_splice_pipe(sched, p) == -1)
+        return (-1);
+
+    while (moved != len) {
+        if (lt->state & BIT(LT_ST_FDEOF)) {
+            ret = -1;
+            break;
+        }
+        _lthread_renice(lt);
+
+        /* fill the pipe, then drain it */
+        if (inpipe == 0) {
+            /* splice() refuses lengths past ssize_t, a pipe holds 64k */
+            ret = splice(fd_in, NULL, p[1], NULL,
+                len - moved > LT_SPLICE_CHUNK ? LT_SPLICE_CHUNK : len - moved,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (ret == 0)
+                break;
+            if (ret > 0)
+                inpipe = ret;
+            else if (errno == EAGAIN)
+                _lthread_sched_event(lt, fd_in, LT_EV_READ, 0);
+            else
+                break;
+            continue;
+        }
+
+        ret = splice(p[0], NULL, fd_out, NULL, inpipe,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (ret > 0) {
+            inpipe -= ret;
+            moved += ret;
+        } else if (ret == -1 && errno == EAGAIN) {
+            _lthread_sched_event(lt, fd_out, LT_EV_WRITE, 0);
+        } else {
+            ret = -1;
+            break;
+        }
+    }
+
+    _lthread_splice_pipe_put(sched, p, inpipe);
+    if (ret == -1)
+        return (-1);
+
+    return (moved);
+}
 #endif
 
 // 对poll的封装，如果timeout是0可以直接非阻塞式调用poll，如果不是0需要自己模拟阻塞式的poll
@@ -506,8 +696,11 @@ lthread_poll(struct pollfd *fds, nfds_t nfds, int timeout)
     lt->pollfds = fds;
     lt->nfds = nfds;
 
-    /* go to sleep until one or more of the fds are ready or until we timeout */
-    _lthread_sched_sleep(lt, (uint64_t)timeout);
+    /*
+     * go to sleep until one or more of the fds are ready or until we timeout.
+     * a negative timeout waits forever like poll(2).
+     */
+    _lthread_sched_sleep(lt, timeout < 0 ? 0 : (uint64_t)timeout);
 
     lt->pollfds = NULL;
     lt->nfds = 0;
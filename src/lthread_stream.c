@@ -0,0 +1,188 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * lthread_stream.c
+ *
+ * Sequential file reads with read-ahead. A stream keeps `depth` chunk sized
+ * preads in flight on the io workers, each on a future, and hands the
+ * chunks back in file order. Handing a chunk back frees the one handed out
+ * before it, and that buffer goes right back out for the next unread chunk,
+ * so the disk keeps busy while the consumer works.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lthread_int.h"
+
+#define LT_STREAM_CHUNK (128 * 1024)
+#define LT_STREAM_DEPTH (4)
+#define LT_STREAM_ALIGN (4096)          /* keeps O_DIRECT fds working */
+
+struct lthread_stream_chunk {
+    char                *buf;
+    struct lthread_future *f;           /* the inflight pread, if any */
+};
+
+struct lthread_file_stream {
+    int                 fd;
+    off_t               offset;         /* where the next pread goes */
+    size_t              chunk;
+    int                 depth;
+    int                 head;           /* next chunk to hand out */
+    int                 held;           /* chunk the consumer has, or -1 */
+    int                 eof;            /* a pread came back short */
+    int                 err;
+    struct lthread_stream_chunk chunks[];
+};
+
+static void
+_lthread_stream_fill(struct lthread_file_stream *s, int i)
+{
+    if (s->eof || s->err)
+        return;
+
+    if (lthread_future_io_pread(&s->chunks[i].f, s->fd, s->chunks[i].buf,
+        s->chunk, s->offset) == -1) {
+        s->chunks[i].f = NULL;
+        s->err = errno;
+        return;
+    }
+    s->offset += s->chunk;
+}
+
+/*
+ * Starts reading fd sequentially from offset, chunk bytes at a time (0 for
+ * 128k) with depth chunks in flight (0 for 4). fd stays the caller's.
+ */
+int
+lthread_file_stream_open(struct lthread_file_stream **s, int fd, off_t offset,
+    size_t chunk, int depth)
+{
+    struct lthread_file_stream *st = NULL;
+    int i = 0;
+
+    if (chunk == 0)
+        chunk = LT_STREAM_CHUNK;
+    if (depth <= 0)
+        depth = LT_STREAM_DEPTH;
+
+    if ((st = calloc(1, sizeof(struct lthread_file_stream) +
+        depth * sizeof(struct lthread_stream_chunk))) == NULL)
+        return (-1);
+    st->fd = fd;
+    st->offset = offset;
+    st->chunk = chunk;
+    st->depth = depth;
+    st->held = -1;
+
+    for (i = 0; i < depth; i++) {
+        if ((errno = posix_memalign((void **)&st->chunks[i].buf,
+            LT_STREAM_ALIGN, chunk)) != 0) {
+            st->chunks[i].buf = NULL;
+            lthread_file_stream_close(st);
+            return (-1);
+        }
+    }
+
+    for (i = 0; i < depth; i++)
+        _lthread_stream_fill(st, i);
+    *s = st;
+
+    return (0);
+}
+
+/*
+ * Waits for the next chunk and points buf at it. buf stays valid until the
+ * next call. Returns the chunk's length, 0 at the end of the file and -1 on
+ * error, with errno set from the failed pread.
+ */
+ssize_t
+lthread_file_stream_read(struct lthread_file_stream *s, void **buf)
+{
+    struct lthread_stream_chunk *c = NULL;
+    ssize_t ret = 0;
+
+    /* the consumer is done with the last chunk, reuse it for read-ahead */
+    if (s->held != -1) {
+        _lthread_stream_fill(s, s->held);
+        s->held = -1;
+    }
+
+    c = &s->chunks[s->head];
+    if (c->f == NULL) {
+        if (s->err) {
+            errno = s->err;
+            return (-1);
+        }
+        return (0);
+    }
+
+    lthread_future_wait(c->f, 0);
+    ret = (ssize_t)(intptr_t)lthread_future_result(c->f);
+    if (ret == -1)
+        s->err = lthread_future_error(c->f);
+    lthread_future_free(c->f);
+    c->f = NULL;
+
+    if (ret == -1) {
+        errno = s->err;
+        return (-1);
+    }
+    /* chunks past the end come back empty, stop asking for more */
+    if ((size_t)ret < s->chunk)
+        s->eof = 1;
+    if (ret == 0)
+        return (0);
+
+    *buf = c->buf;
+    s->held = s->head;
+    s->head = (s->head + 1) % s->depth;
+
+    return (ret);
+}
+
+/* waits out the reads still in flight and frees the stream */
+void
+lthread_file_stream_close(struct lthread_file_stream *s)
+{
+    int i = 0;
+
+    for (i = 0; i < s->depth; i++) {
+        if (s->chunks[i].f != NULL) {
+            lthread_future_wait(s->chunks[i].f, 0);
+            lthread_future_free(s->chunks[i].f);
+        }
+        free(s->chunks[i].buf);
+    }
+    free(s);
+}
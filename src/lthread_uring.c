@@ -0,0 +1,362 @@
+/*
+ * Lthread
+ * Copyright (C) 2012, Hasan Alayli <halayli@gmail.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * lthread_uring.c
+ *
+ * io_uring backend for the lthread_io reads, writes and syncs. Each
+ * scheduler owns a ring, created on first use, whose completions signal the
+ * scheduler's eventfd. SQEs queued by lthreads are submitted with one
+ * io_uring_enter() right before the scheduler polls and CQEs are reaped right
+ * after, so an io op costs no thread hop. Schedulers fall back to the io
+ * workers if the kernel lacks io_uring or the ring is full, and for ops the
+ * ring doesn't take.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "lthread_int.h"
+
+enum {
+    LT_URING_ENTRIES = 256
+};
+
+struct lthread_uring {
+    int                 fd;
+    unsigned            *sq_head;
+    unsigned            *sq_tail;
+    unsigned            *sq_mask;
+    unsigned            *sq_array;
+    unsigned            sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned            *cq_head;
+    unsigned            *cq_tail;
+    unsigned            *cq_mask;
+    unsigned            cq_entries;
+    struct io_uring_cqe *cqes;
+    void                *sq_ptr;
+    size_t              sq_len;
+    void                *cq_ptr;
+    size_t              cq_len;
+    size_t              sqes_len;
+    unsigned            to_submit;      /* queued since the last enter */
+    unsigned            inflight;       /* submitted, not reaped yet */
+};
+
+static int
+_lthread_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+_lthread_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+    return (syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+        NULL, 0));
+}
+
+static int
+_lthread_uring_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+    return (syscall(__NR_io_uring_register, fd, opcode, arg, nargs));
+}
+
+/* the kernel must know IORING_OP_READ/WRITE for us to use the ring */
+static int
+_lthread_uring_probe(int fd)
+{
+    struct io_uring_probe *probe = NULL;
+    size_t len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+    int ok = 0;
+
+    if ((probe = calloc(1, len)) == NULL)
+        return (0);
+
+    if (_lthread_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0)
+        ok = probe->last_op >= IORING_OP_WRITE &&
+            (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+            (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+
+    return (ok);
+}
+
+static void
+_lthread_uring_destroy(struct lthread_uring *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED &&
+        ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_len);
+    if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+        munmap(ring->sq_ptr, ring->sq_len);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    free(ring);
+}
+
+static struct lthread_uring *
+_lthread_uring_create(struct lthread_sched *sched)
+{
+    struct lthread_uring *ring = NULL;
+    struct io_uring_params p;
+
+    if ((ring = calloc(1, sizeof(struct lthread_uring))) == NULL)
+        return (NULL);
+
+    memset(&p, 0, sizeof(p));
+    if ((ring->fd = _lthread_uring_setup(LT_URING_ENTRIES, &p)) == -1)
+        goto err;
+
+    /* we pass -1 as the offset to read/write at the file position */
+    if (!(p.features & IORING_FEAT_RW_CUR_POS) ||
+        !_lthread_uring_probe(ring->fd))
+        goto err;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len)
+            ring->sq_len = ring->cq_len;
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto err;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ptr = ring->sq_ptr;
+    else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED)
+            goto err;
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto err;
+
+    ring->sq_head = ring->sq_ptr + p.sq_off.head;
+    ring->sq_tail = ring->sq_ptr + p.sq_off.tail;
+    ring->sq_mask = ring->sq_ptr + p.sq_off.ring_mask;
+    ring->sq_array = ring->sq_ptr + p.sq_off.array;
+    ring->sq_entries = p.sq_entries;
+    ring->cq_head = ring->cq_ptr + p.cq_off.head;
+    ring->cq_tail = ring->cq_ptr + p.cq_off.tail;
+    ring->cq_mask = ring->cq_ptr + p.cq_off.ring_mask;
+    ring->cqes = ring->cq_ptr + p.cq_off.cqes;
+    ring->cq_entries = p.cq_entries;
+
+    /* completions wake the scheduler up like a trigger from an io worker */
+    if (_lthread_uring_register(ring->fd, IORING_REGISTER_EVENTFD,
+        &sched->eventfd, 1) == -1)
+        goto err;
+
+    return (ring);
+
+err:
+    _lthread_uring_destroy(ring);
+    return (NULL);
+}
+
+/* submits the SQEs queued since the last call */
+void
+_lthread_uring_flush(struct lthread_sched *sched)
+{
+    struct lthread_uring *ring = sched->uring;
+    int ret = 0;
+
+    while (ring->to_submit) {
+        ret = _lthread_uring_enter(ring->fd, ring->to_submit, 0, 0);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            /* EAGAIN/EBUSY: the kernel is short on resources, retry later */
+            return;
+        }
+        ring->to_submit -= ret;
+    }
+}
+
+/*
+ * Queues req on the scheduler's ring. req->lt must be parked until
+ * _lthread_uring_reap() resumes it. Returns -1 if the ring can't take it and
+ * req should go to an io worker instead.
+ */
+int
+_lthread_uring_submit(struct lthread_sched *sched, struct lthread_io_req *req)
+{
+    struct lthread_uring *ring = NULL;
+    struct io_uring_sqe *sqe = NULL;
+    unsigned tail = 0;
+
+    if (sched->no_uring)
+        return (-1);
+
+    if (sched->uring == NULL &&
+        (sched->uring = _lthread_uring_create(sched)) == NULL) {
+        sched->no_uring = 1;
+        return (-1);
+    }
+    ring = sched->uring;
+
+    /* don't let completions outrun the cq */
+    if (ring->inflight >= ring->cq_entries)
+        return (-1);
+
+    tail = *ring->sq_tail;
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+        ring->sq_entries) {
+        _lthread_uring_flush(sched);
+        if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+            ring->sq_entries)
+            return (-1);
+    }
+
+    sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = req->fd;
+    sqe->addr = (uintptr_t)req->buf;
+    sqe->len = req->nbytes;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = (uintptr_t)req;
+    switch (req->op) {
+    case LT_IO_READ:
+        sqe->opcode = IORING_OP_READ;
+        break;
+    case LT_IO_WRITE:
+        sqe->opcode = IORING_OP_WRITE;
+        break;
+    case LT_IO_PREAD:
+        sqe->opcode = IORING_OP_READ;
+        sqe->off = req->offset;
+        break;
+    case LT_IO_PWRITE:
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->off = req->offset;
+        break;
+    case LT_IO_READV:
+    case LT_IO_WRITEV:
+        sqe->opcode = (req->op == LT_IO_READV) ?
+            IORING_OP_READV : IORING_OP_WRITEV;
+        sqe->addr = (uintptr_t)req->iov;
+        sqe->len = req->iovcnt;
+        break;
+    case LT_IO_FSYNC:
+    case LT_IO_FDATASYNC:
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->addr = 0;
+        sqe->len = 0;
+        sqe->off = 0;
+        if (req->op == LT_IO_FDATASYNC)
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        break;
+    default:
+        /* path based ops and close go to the io workers */
+        return (-1);
+    }
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->to_submit++;
+    ring->inflight++;
+
+    return (0);
+}
+
+/* resumes the lthreads whose ops completed */
+void
+_lthread_uring_reap(struct lthread_sched *sched)
+{
+    struct lthread_uring *ring = sched->uring;
+    struct lthread_io_req *req = NULL;
+    struct io_uring_cqe *cqe = NULL;
+    unsigned head = 0;
+
+    head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        req = (struct lthread_io_req *)(uintptr_t)cqe->user_data;
+        req->ret = (cqe->res < 0) ? -1 : cqe->res;
+        req->err = (cqe->res < 0) ? -cqe->res : 0;
+        head++;
+        /* let the kernel reuse the cqe before the lthread runs */
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        ring->inflight--;
+
+        LIST_REMOVE(req->lt, busy_next);
+        _lthread_resume(req->lt);
+    }
+}
+
+void
+_lthread_uring_free(struct lthread_sched *sched)
+{
+    if (sched->uring == NULL)
+        return;
+
+    /* lthread_run() only returns once no lthread is parked on the ring */
+    assert(sched->uring->inflight == 0);
+    _lthread_uring_destroy(sched->uring);
+    sched->uring = NULL;
+}
+
+/*
+ * Enables (the default) or disables io_uring for lthread_io calls in the
+ * calling pthread's scheduler. When disabled, or if the kernel doesn't
+ * support it, io goes through the io workers.
+ */
+int
+lthread_io_set_uring(int enable)
+{
+    struct lthread_sched *sched = lthread_get_sched();
+
+    if (sched == NULL) {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    sched->no_uring = !enable;
+
+    return (0);
+}
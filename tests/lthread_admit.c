@@ -0,0 +1,74 @@
+#include "lthread.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+static int ran = 0;
+
+void
+sleeper(void *arg)
+{
+    lthread_detach();
+    ran++;
+    lthread_sleep((uint64_t)(uintptr_t)arg);
+}
+
+static uint64_t
+msecs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000 + tv.tv_usec / 1000);
+}
+
+void
+driver(void *arg)
+{
+    struct lthread_sched_stats stats;
+    lthread_t *lt = NULL;
+    uint64_t t1 = 0;
+    int ret = 0, created = 0;
+    lthread_detach();
+
+    /* the driver holds one of the 3 slots */
+    lthread_sched_set_limit(3, LTHREAD_ADMIT_FAIL, 0);
+    while ((ret = lthread_create(&lt, sleeper, (void *)100)) == 0)
+        created++;
+    lthread_sched_stats(&stats);
+    printf("fail: %d created, then %s, %lu rejected\n", created,
+        ret == EAGAIN ? "EAGAIN" : "unexpected error",
+        (unsigned long)stats.rejected);
+
+    /* a full scheduler parks the creator until a sleeper exits */
+    lthread_sched_set_limit(3, LTHREAD_ADMIT_BLOCK, 0);
+    t1 = msecs();
+    ret = lthread_create(&lt, sleeper, (void *)10);
+    lthread_sched_stats(&stats);
+    printf("block: created %d after waiting %s, %lu blocked\n", ret,
+        msecs() - t1 >= 90 ? "for a slot" : "TOO LITTLE",
+        (unsigned long)stats.blocked);
+
+    /* a queued spawn has no stack, cancelling it just drops it */
+    lthread_sched_set_limit(1, LTHREAD_ADMIT_QUEUE, 0);
+    ran = 0;
+    lthread_create(&lt, sleeper, (void *)10);
+    lthread_sched_stats(&stats);
+    printf("queue: %lu queued\n", (unsigned long)stats.queued_lthreads);
+    lthread_cancel(lt);
+    lthread_sched_stats(&stats);
+    printf("queue: %lu queued after cancel, join returned %d, ran %d\n",
+        (unsigned long)stats.queued_lthreads, lthread_join(lt, NULL, 1000),
+        ran);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+
+    lthread_create(&lt, driver, NULL);
+    lthread_run();
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "lthread.h"
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+void
+pinned(void *arg)
+{
+    printf("lthread on numa node %d\n", lthread_numa_node());
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    int ret = 0;
+
+    ret = lthread_set_cpu(-1);
+    printf("lthread_set_cpu(-1) returned %d, %s\n", ret,
+        errno == EINVAL ? "EINVAL" : "unexpected errno");
+
+    if (lthread_set_cpu(0) == -1)
+        perror("lthread_set_cpu");
+
+    lthread_create(&lt, pinned, NULL);
+    printf("scheduler pinned to cpu 0 is on numa node %d\n",
+        lthread_numa_node());
+    lthread_run();
+
+    return 0;
+}
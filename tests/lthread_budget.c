@@ -0,0 +1,81 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <sys/time.h>
+
+#define WORKERS 20
+
+static int running = 0;
+
+static uint64_t
+usecs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+/* hogs the cpu for arg usecs, a few times over */
+void
+worker(void *arg)
+{
+    uint64_t t1 = 0;
+    int i = 0;
+    lthread_detach();
+
+    for (i = 0; i < 3; i++) {
+        t1 = usecs();
+        while (usecs() - t1 < (uint64_t)(uintptr_t)arg)
+            ;
+        lthread_sleep(0);
+    }
+    running--;
+}
+
+static void
+run_workers(uint64_t busy)
+{
+    lthread_t *lt = NULL;
+    int i = 0;
+
+    running = WORKERS;
+    for (i = 0; i < WORKERS; i++)
+        lthread_create(&lt, worker, (void *)(uintptr_t)busy);
+    while (running)
+        lthread_sleep(1);
+}
+
+void
+driver(void *arg)
+{
+    struct lthread_sched_stats stats;
+    uint64_t exhausted = 0;
+    lthread_detach();
+
+    /* at most 4 lthreads per pass */
+    lthread_sched_set_budget(4, 0);
+    run_workers(0);
+    lthread_sched_stats(&stats);
+    printf("count budget: longest pass %lu lthreads (%s), %lu passes cut short\n",
+        (unsigned long)stats.ready_max, stats.ready_max <= 4 ? "ok" : "OVER",
+        (unsigned long)stats.budget_exhausted);
+    exhausted = stats.budget_exhausted;
+
+    /* at most 2ms of lthreads hogging 1ms each per pass */
+    lthread_sched_set_budget(0, 2000);
+    run_workers(1000);
+    lthread_sched_stats(&stats);
+    printf("time budget: %s passes cut short\n",
+        stats.budget_exhausted > exhausted ? "more" : "NO MORE");
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+
+    lthread_create(&lt, driver, NULL);
+    lthread_run();
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WRITERS 200
+#define RECORDS 10
+
+static lthread_commit_t *wal = NULL;
+static int running = WRITERS;
+
+void
+writer(void *arg)
+{
+    char rec[64];
+    int i = 0, n = 0;
+    lthread_detach();
+
+    for (i = 0; i < RECORDS; i++) {
+        n = snprintf(rec, sizeof(rec), "writer %ld record %d\n",
+            (long)(intptr_t)arg, i);
+        if (lthread_commit_append(wal, rec, n) != n)
+            perror("lthread_commit_append");
+    }
+
+    if (--running == 0) {
+        struct lthread_commit_stats stats;
+        lthread_commit_stats(wal, &stats);
+        printf("%lu durable appends took %lu fdatasyncs\n",
+            (unsigned long)stats.appends, (unsigned long)stats.syncs);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    long i = 0;
+    int fd = 0;
+
+    fd = open("/tmp/lthread_commit.log", O_CREAT | O_TRUNC | O_WRONLY | O_APPEND,
+        0640);
+    lthread_commit_create(&wal, fd);
+    for (i = 0; i < WRITERS; i++)
+        lthread_create(&lt, writer, (void *)i);
+    lthread_run();
+
+    lthread_commit_free(wal);
+    close(fd);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <unistd.h>
+
+#define NLTHREADS 8
+
+static int done = 0;
+
+void
+spin(void *arg)
+{
+    lthread_detach();
+
+    lthread_compute_begin();
+        usleep(50000);
+    lthread_compute_end();
+
+    printf("lthread %ld done computing\n", (long)arg);
+    done++;
+}
+
+void *
+quick(void *arg)
+{
+    return (arg);
+}
+
+/* runs on its own pool so it doesn't queue behind spin() */
+void
+latency(void *arg)
+{
+    lthread_compute_pool_t *pool = lthread_compute_pool_find("latency");
+    void *ret = NULL;
+    lthread_detach();
+
+    lthread_compute_call_pool(pool, quick, "fast", &ret);
+    printf("latency pool answered %s before the spinners were done\n",
+        done < NLTHREADS ? (char *)ret : "too late");
+}
+
+void
+report(void *arg)
+{
+    struct lthread_compute_stats stats;
+    lthread_detach();
+
+    while (done != NLTHREADS)
+        lthread_sleep(50);
+
+    lthread_compute_stats(&stats);
+    printf("workers %llu submitted %llu queued_max %llu wait_max %llu us\n",
+        (unsigned long long)stats.workers,
+        (unsigned long long)stats.submitted,
+        (unsigned long long)stats.queued_max,
+        (unsigned long long)stats.wait_usecs_max);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    lthread_compute_pool_t *pool = NULL;
+    long i = 0;
+
+    /* two workers for eight compute blocks, the rest have to queue */
+    lthread_compute_set_workers(2);
+    lthread_compute_pool_create(&pool, "latency", 1, 16, NULL, 0);
+
+    for (i = 0; i < NLTHREADS; i++)
+        lthread_create(&lt, spin, (void *)i);
+    lthread_create(&lt, latency, NULL);
+    lthread_create(&lt, report, NULL);
+    lthread_run();
+
+    return 0;
+}
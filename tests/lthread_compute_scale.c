@@ -0,0 +1,62 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <unistd.h>
+
+#define TASKS 8
+
+static int running = TASKS;
+
+void
+busy(void *arg)
+{
+    lthread_detach();
+
+    lthread_compute_begin();
+    usleep(50 * 1000);
+    lthread_compute_end();
+    running--;
+}
+
+void
+driver(void *arg)
+{
+    struct lthread_compute_pool_config config = {
+        .min_workers = 1,
+        .max_workers = 4,
+        .idle_timeout = 100,
+        .scale_queued = 1
+    };
+    struct lthread_compute_stats stats;
+    lthread_t *lt = NULL;
+    int i = 0;
+    lthread_detach();
+
+    lthread_compute_configure(&config);
+    lthread_compute_stats(&stats);
+    printf("idle pool: %lu workers\n", (unsigned long)stats.workers);
+
+    for (i = 0; i < TASKS; i++)
+        lthread_create(&lt, busy, NULL);
+    while (running)
+        lthread_sleep(10);
+    lthread_compute_stats(&stats);
+    printf("under load: %lu workers, %lu scaled up\n",
+        (unsigned long)stats.workers, (unsigned long)stats.scaled_up);
+
+    /* the extra workers retire after idling for 100ms */
+    lthread_sleep(500);
+    lthread_compute_stats(&stats);
+    printf("idle again: %lu workers, %lu scaled down\n",
+        (unsigned long)stats.workers, (unsigned long)stats.scaled_down);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+
+    lthread_create(&lt, driver, NULL);
+    lthread_run();
+
+    return 0;
+}
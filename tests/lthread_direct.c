@@ -0,0 +1,68 @@
+#include "lthread.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCKS 32
+#define BLOCK_SIZE (64 * 1024)
+
+static lthread_io_buf_pool_t *pool = NULL;
+static int fd = -1;
+static int running = BLOCKS;
+static int bad = 0;
+
+void
+block_io(void *arg)
+{
+    long blk = (long)(intptr_t)arg;
+    char *buf = NULL;
+    lthread_detach();
+
+    buf = lthread_io_buf_get(pool);
+    memset(buf, 'a' + blk % 26, BLOCK_SIZE);
+    if (lthread_io_pwrite(fd, buf, BLOCK_SIZE, blk * BLOCK_SIZE) != BLOCK_SIZE)
+        perror("lthread_io_pwrite");
+    lthread_io_buf_put(pool, buf);
+
+    buf = lthread_io_buf_get(pool);
+    memset(buf, 0, BLOCK_SIZE);
+    if (lthread_io_pread(fd, buf, BLOCK_SIZE, blk * BLOCK_SIZE) != BLOCK_SIZE ||
+        buf[0] != 'a' + blk % 26 || buf[BLOCK_SIZE - 1] != 'a' + blk % 26)
+        bad++;
+    lthread_io_buf_put(pool, buf);
+
+    if (--running == 0) {
+        struct lthread_io_buf_stats stats;
+        lthread_io_buf_pool_stats(pool, &stats);
+        printf("%d blocks, %d bad, %lu borrows from %lu buffers, %lu waits\n",
+            BLOCKS, bad, (unsigned long)stats.borrowed,
+            (unsigned long)stats.bufs, (unsigned long)stats.waited);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    long i = 0;
+
+    fd = lthread_io_open_direct("/var/tmp/lthread_direct.dat",
+        O_CREAT | O_TRUNC | O_RDWR, 0640);
+    if (fd == -1 && errno == EINVAL) {
+        printf("no O_DIRECT on /var/tmp, using the page cache\n");
+        fd = lthread_io_open("/var/tmp/lthread_direct.dat",
+            O_CREAT | O_TRUNC | O_RDWR, 0640);
+    }
+    lthread_io_buf_pool_create(&pool, BLOCK_SIZE, 4, 0);
+
+    for (i = 0; i < BLOCKS; i++)
+        lthread_create(&lt, block_io, (void *)i);
+    lthread_run();
+
+    lthread_io_buf_pool_free(pool);
+    close(fd);
+    unlink("/var/tmp/lthread_direct.dat");
+
+    return 0;
+}
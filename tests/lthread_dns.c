@@ -0,0 +1,68 @@
+#include "lthread.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define LOOKUPS 20
+
+static int running = LOOKUPS;
+
+static void
+resolve(const char *node, const char *what)
+{
+    struct addrinfo hints, *res = NULL, *ai = NULL;
+    char addr[INET6_ADDRSTRLEN];
+    struct timeval t1, t2;
+    int ret = 0;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    gettimeofday(&t1, NULL);
+    ret = lthread_getaddrinfo(node, "80", &hints, &res);
+    gettimeofday(&t2, NULL);
+    if (ret != 0) {
+        printf("%s %s: %s\n", what, node, gai_strerror(ret));
+        return;
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        inet_ntop(AF_INET, &((struct sockaddr_in *)ai->ai_addr)->sin_addr,
+            addr, sizeof(addr));
+        printf("%s %s: %s port %d in %ld usecs\n", what, node, addr,
+            ntohs(((struct sockaddr_in *)ai->ai_addr)->sin_port),
+            (long)((t2.tv_sec - t1.tv_sec) * 1000000 +
+            t2.tv_usec - t1.tv_usec));
+    }
+    lthread_freeaddrinfo(res);
+}
+
+void
+lookup(void *arg)
+{
+    lthread_detach();
+
+    /* all of these share one resolution */
+    resolve("localhost", "concurrent");
+
+    if (--running == 0) {
+        resolve("localhost", "cached");
+        lthread_getaddrinfo_set_ttl(0);
+        resolve("localhost", "uncached");
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    int i = 0;
+
+    for (i = 0; i < LOOKUPS; i++)
+        lthread_create(&lt, lookup, NULL);
+    lthread_run();
+
+    return 0;
+}
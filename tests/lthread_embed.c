@@ -0,0 +1,70 @@
+#include "lthread.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static int fds[2];
+
+void
+sleeper(void *arg)
+{
+    lthread_detach();
+    lthread_sleep(30);
+    printf("sleeper woke up\n");
+}
+
+void
+reader(void *arg)
+{
+    char buf[16] = {0};
+    lthread_detach();
+
+    lthread_read(fds[0], buf, sizeof(buf) - 1, 0);
+    printf("reader read %s\n", buf);
+}
+
+void *
+writer(void *arg)
+{
+    usleep(60 * 1000);
+    write(fds[1], "hello", 5);
+
+    return (NULL);
+}
+
+/* a foreign event loop driving the scheduler through its poller fd */
+int
+main(int argc, char **argv)
+{
+    struct epoll_event ev = {0};
+    lthread_t *lt = NULL;
+    pthread_t pthread;
+    int epfd = 0, timeouts = 0, wakeups = 0, n = 0;
+
+    lthread_pipe(fds);
+    lthread_create(&lt, sleeper, NULL);
+    lthread_create(&lt, reader, NULL);
+    pthread_create(&pthread, NULL, writer, NULL);
+
+    epfd = epoll_create1(0);
+    ev.events = EPOLLIN;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lthread_sched_poller_fd(), &ev);
+
+    while (lthread_run_once(0) == 1) {
+        n = epoll_wait(epfd, &ev, 1, lthread_sched_timeout());
+        if (n == 0)
+            timeouts++;
+        else if (n == 1)
+            wakeups++;
+    }
+    printf("event loop done: %s timer wakeup, %s fd wakeup\n",
+        timeouts ? "saw a" : "NO", wakeups ? "saw an" : "NO");
+
+    /* frees the scheduler */
+    lthread_run();
+    pthread_join(pthread, NULL);
+    close(epfd);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PATH "/tmp/lthread_file.txt"
+
+static void
+file_ops(int uring)
+{
+    char head[] = "head ", tail[] = "tail\n", buf[64] = {0};
+    struct iovec iov[2];
+    struct stat st;
+    int fd = 0;
+
+    lthread_io_set_uring(uring);
+
+    fd = lthread_io_open(PATH, O_CREAT | O_TRUNC | O_RDWR, 0640);
+    iov[0].iov_base = head;
+    iov[0].iov_len = strlen(head);
+    iov[1].iov_base = tail;
+    iov[1].iov_len = strlen(tail);
+    lthread_io_writev(fd, iov, 2);
+    lthread_io_pwrite(fd, "HEAD", 4, 0);
+    lthread_io_fdatasync(fd);
+    lthread_io_fstat(fd, &st);
+    printf("uring %d: wrote %ld bytes\n", uring, (long)st.st_size);
+
+    lthread_io_pread(fd, buf, sizeof(buf) - 1, 0);
+    printf("uring %d: pread %s", uring, buf);
+
+    memset(buf, 0, sizeof(buf));
+    lseek(fd, 0, SEEK_SET);
+    iov[0].iov_base = buf;
+    iov[0].iov_len = 5;
+    iov[1].iov_base = buf + 5;
+    iov[1].iov_len = sizeof(buf) - 6;
+    lthread_io_readv(fd, iov, 2);
+    printf("uring %d: readv %s", uring, buf);
+
+    lthread_io_fsync(fd);
+    lthread_io_close(fd);
+    lthread_io_unlink(PATH);
+    printf("uring %d: stat after unlink returned %d\n", uring,
+        lthread_io_stat(PATH, &st));
+}
+
+void
+a(void *arg)
+{
+    lthread_detach();
+
+    file_ops(1);
+    file_ops(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+
+    lthread_create(&lt, a, NULL);
+    lthread_run();
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "lthread.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int pipefd[2];
+
+void *
+sum_to(void *arg)
+{
+    uint64_t n = (uintptr_t)arg;
+    uint64_t sum = 0;
+    uint64_t i = 0;
+
+    for (i = 0; i <= n; i++)
+        sum += i;
+
+    return ((void *)(uintptr_t)sum);
+}
+
+void
+a(void *arg)
+{
+    lthread_future_t *fs[2] = {NULL, NULL};
+    lthread_future_t *promise = NULL;
+    char buf[64] = {0};
+    int i = 0;
+    lthread_detach();
+
+    /* overlap a read and a computation, take whichever finishes first */
+    lthread_future_io_read(&fs[0], pipefd[0], buf, sizeof(buf) - 1);
+    lthread_future_compute(&fs[1], sum_to, (void *)(uintptr_t)10000000);
+
+    i = lthread_future_wait_any(fs, 2, 0);
+    printf("future %d finished first\n", i);
+    lthread_future_wait(fs[0], 0);
+    lthread_future_wait(fs[1], 0);
+    printf("read %ld bytes: %s\n",
+        (long)(intptr_t)lthread_future_result(fs[0]), buf);
+    printf("sum is %lu\n", (unsigned long)(uintptr_t)lthread_future_result(fs[1]));
+    lthread_future_free(fs[0]);
+    lthread_future_free(fs[1]);
+
+    /* nobody sets this one */
+    lthread_future_create(&promise);
+    printf("wait with timeout returned %d\n",
+        lthread_future_wait(promise, 10));
+    lthread_future_set(promise, (void *)1, 0);
+    printf("after set: %d %p\n", lthread_future_wait(promise, 10),
+        lthread_future_result(promise));
+    lthread_future_free(promise);
+}
+
+/* keeps running while a waits */
+void
+b(void *arg)
+{
+    char msg[] = "hello from b";
+    int i = 0;
+    lthread_detach();
+
+    for (i = 0; i < 3; i++) {
+        printf("b tick %d\n", i);
+        lthread_sleep(5);
+    }
+    write(pipefd[1], msg, strlen(msg));
+}
+
+/* sets a promise from another pthread after 50ms */
+void *
+setter(void *arg)
+{
+    usleep(50000);
+    lthread_future_set(arg, (void *)2, 0);
+    return (NULL);
+}
+
+/* waits from a plain pthread, must block instead of spinning */
+void
+wait_outside(void)
+{
+    lthread_future_t *fs[2] = {NULL, NULL};
+    struct timespec start, end;
+    pthread_t tid;
+    double cpu = 0;
+
+    lthread_future_create(&fs[0]);
+    lthread_future_create(&fs[1]);
+    printf("outside: wait with timeout returned %d\n",
+        lthread_future_wait(fs[0], 10));
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    pthread_create(&tid, NULL, setter, fs[1]);
+    printf("outside: future %d finished first\n",
+        lthread_future_wait_any(fs, 2, 0));
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+    pthread_join(tid, NULL);
+    cpu = (end.tv_sec - start.tv_sec) * 1e3 +
+        (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("outside: result %p, %s\n", lthread_future_result(fs[1]),
+        cpu < 25 ? "blocked" : "spun");
+
+    lthread_future_free(fs[0]);
+    lthread_future_free(fs[1]);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+
+    wait_outside();
+    pipe(pipefd);
+    lthread_create(&lt, a, NULL);
+    lthread_create(&lt, b, NULL);
+    lthread_run();
+
+    return 0;
+}
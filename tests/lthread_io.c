@@ -32,6 +32,22 @@ a(void *arg)
 
     }
     printf("io_write took %lf msec (avg: %lf usec) to write %d lines\n", total, total / (double)x, x);
+
+    /* same writes through the io workers instead of io_uring */
+    struct lthread_io_stats stats[4];
+    int n = 0;
+    lthread_io_set_uring(0);
+    lthread_io_set_workers(4);
+    i = x;
+    while (i--)
+        lthread_io_write(fd, line, sizeof(line));
+    n = lthread_io_stats(stats, 4);
+    for (i = 0; i < n && i < 4; i++)
+        printf("io worker %d: %lu done, depth max %lu, latency max %lu usec\n",
+            i, (unsigned long)stats[i].completed,
+            (unsigned long)stats[i].depth_max,
+            (unsigned long)stats[i].latency_usecs_max);
+    close(fd);
 }
 
 void
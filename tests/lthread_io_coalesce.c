@@ -0,0 +1,266 @@
+#include "lthread.h"
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WRITERS 20
+#define RECORDS 100
+#define RECLEN  16
+#define LIMIT   (RECORDS * RECLEN * 10 + 7)   /* ends mid-record */
+
+static int running = 0;
+static int bad = 0;
+static int short_writes = 0;
+static ssize_t accepted = 0;
+static int done[WRITERS];   /* records each writer got fully written */
+static int fd = -1;
+
+static void
+record(char *buf, int w, int seq)
+{
+    char tmp[RECLEN + 1];
+
+    snprintf(tmp, sizeof(tmp), "w%03d seq%07d\n", w, seq);
+    memcpy(buf, tmp, RECLEN);
+}
+
+/* appends with write(), merged into a writev only on a regular file */
+void
+appender(void *arg)
+{
+    int w = (intptr_t)arg;
+    char buf[RECLEN];
+    ssize_t ret = 0;
+    int i = 0;
+    lthread_detach();
+
+    for (i = 0; i < RECORDS; i++) {
+        record(buf, w, i);
+        ret = lthread_io_write(fd, buf, RECLEN);
+        if (ret == -1 && errno == EFBIG)
+            break;
+        if (ret == -1 || ret == 0 || ret > RECLEN) {
+            bad++;
+            break;
+        }
+        accepted += ret;
+        if (ret < RECLEN) {
+            short_writes++;
+            break;
+        }
+        done[w]++;
+    }
+    running--;
+}
+
+/* writes round i of every writer back to back, so offsets are contiguous */
+void
+pwriter(void *arg)
+{
+    int w = (intptr_t)arg;
+    char buf[RECLEN];
+    int i = 0;
+    lthread_detach();
+
+    for (i = 0; i < RECORDS; i++) {
+        record(buf, w, i);
+        if (lthread_io_pwrite(fd, buf, RECLEN,
+            ((off_t)i * WRITERS + w) * RECLEN) != RECLEN)
+            bad++;
+    }
+    running--;
+}
+
+/* reads datagrams, every write must stay a datagram of its own */
+void *
+reader(void *arg)
+{
+    int sock = (intptr_t)arg;
+    char buf[64 * RECLEN * 2];
+    int next[WRITERS] = {0};
+    int records = 0, datagrams = 0;
+    ssize_t n = 0, off = 0;
+    int w = 0, seq = 0;
+
+    while (records < WRITERS * RECORDS) {
+        if ((n = recv(sock, buf, sizeof(buf), 0)) <= 0)
+            break;
+        datagrams++;
+        if (n % RECLEN)
+            bad++;
+        for (off = 0; off + RECLEN <= n; off += RECLEN) {
+            if (sscanf(buf + off, "w%d seq%d", &w, &seq) != 2 ||
+                w < 0 || w >= WRITERS || seq != next[w]) {
+                bad++;
+                continue;
+            }
+            next[w]++;
+            records++;
+        }
+    }
+    if (datagrams != records)
+        bad++;
+    printf("%d records in %d datagrams\n", records, datagrams);
+
+    return (NULL);
+}
+
+/* write syscalls this process made so far, -1 without io accounting */
+static long
+write_calls(void)
+{
+    char line[64];
+    long n = -1;
+    FILE *fp = fopen("/proc/self/io", "r");
+
+    if (fp == NULL)
+        return (-1);
+    while (fgets(line, sizeof(line), fp))
+        if (sscanf(line, "syscw: %ld", &n) == 1)
+            break;
+    fclose(fp);
+
+    return (n);
+}
+
+static void
+wait_writers(void)
+{
+    while (running)
+        lthread_sleep(1);
+}
+
+static void
+spawn(lthread_func fn)
+{
+    lthread_t *lt = NULL;
+    long i = 0;
+
+    running = WRITERS;
+    for (i = 0; i < WRITERS; i++)
+        lthread_create(&lt, fn, (void *)i);
+}
+
+/* every writer's records must be in the file, in its own order */
+static void
+check_file(const char *path, int contiguous)
+{
+    char buf[RECLEN + 1] = {0};
+    int next[WRITERS] = {0};
+    int in = open(path, O_RDONLY);
+    int w = 0, seq = 0, i = 0;
+    ssize_t n = 0;
+
+    while ((n = read(in, buf, RECLEN)) == RECLEN) {
+        if (sscanf(buf, "w%d seq%d", &w, &seq) != 2 ||
+            w < 0 || w >= WRITERS || seq != next[w] ||
+            (contiguous && w != i % WRITERS)) {
+            bad++;
+            break;
+        }
+        next[w]++;
+        i++;
+    }
+    for (w = 0; w < WRITERS; w++)
+        if (next[w] != (contiguous ? RECORDS : done[w]))
+            bad++;
+    close(in);
+}
+
+void
+driver(void *arg)
+{
+    struct lthread_io_stats stats;
+    struct rlimit rl = {LIMIT, LIMIT};
+    int sv[2];
+    pthread_t tid;
+    struct stat st;
+    long calls = 0;
+    lthread_detach();
+
+    /* coalescing happens in the io workers, keep io_uring out of the way */
+    lthread_io_set_uring(0);
+
+    /* datagram boundaries must survive, nothing gets merged here */
+    socketpair(AF_UNIX, SOCK_DGRAM, 0, sv);
+    pthread_create(&tid, NULL, reader, (void *)(intptr_t)sv[1]);
+    fd = sv[0];
+    spawn(appender);
+    wait_writers();
+    pthread_join(tid, NULL);
+    close(sv[0]);
+    close(sv[1]);
+
+    /*
+     * appends to a regular file do get merged. every batch costs one
+     * writev plus the poller wakeup, still far fewer than one per record.
+     */
+    fd = open("/tmp/lthread_io_coalesce.append",
+        O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0640);
+    memset(done, 0, sizeof(done));
+    calls = write_calls();
+    spawn(appender);
+    wait_writers();
+    if (calls != -1) {
+        calls = write_calls() - calls;
+        if (calls >= WRITERS * RECORDS)
+            bad++;
+        printf("%d appends took %ld write calls\n", WRITERS * RECORDS, calls);
+    }
+    close(fd);
+    check_file("/tmp/lthread_io_coalesce.append", 0);
+
+    fd = open("/tmp/lthread_io_coalesce.pwrite",
+        O_CREAT | O_TRUNC | O_WRONLY, 0640);
+    spawn(pwriter);
+    wait_writers();
+    close(fd);
+    check_file("/tmp/lthread_io_coalesce.pwrite", 1);
+
+    /*
+     * cap the file size mid-record: a merged writev comes back short, and
+     * the requests after it must be rerun alone and fail on their own.
+     */
+    signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &rl);
+    memset(done, 0, sizeof(done));
+    accepted = 0;
+    fd = open("/tmp/lthread_io_coalesce.append",
+        O_CREAT | O_TRUNC | O_WRONLY | O_APPEND, 0640);
+    spawn(appender);
+    wait_writers();
+    close(fd);
+    stat("/tmp/lthread_io_coalesce.append", &st);
+    check_file("/tmp/lthread_io_coalesce.append", 0);
+    if (short_writes != 1 || accepted != LIMIT || st.st_size != LIMIT)
+        bad++;
+    printf("%ld bytes accepted of %ld, %d short writes\n",
+        (long)accepted, (long)LIMIT, short_writes);
+
+    lthread_io_stats(&stats, 1);
+    printf("io worker 0: %lu done, depth max %lu\n",
+        (unsigned long)stats.completed, (unsigned long)stats.depth_max);
+    printf("%d bad\n", bad);
+
+    unlink("/tmp/lthread_io_coalesce.pwrite");
+    unlink("/tmp/lthread_io_coalesce.append");
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+
+    /* one worker sees every request, so batches actually form */
+    lthread_io_set_workers(1);
+    lthread_create(&lt, driver, NULL);
+    lthread_run();
+
+    return (bad != 0);
+}
@@ -0,0 +1,55 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOGGERS 100
+#define LINES 100
+
+static int running = LOGGERS;
+
+void
+logger(void *arg)
+{
+    int i = 0;
+    lthread_detach();
+
+    for (i = 0; i < LINES; i++) {
+        lthread_log("logger %ld line %d\n", (long)(intptr_t)arg, i);
+        if (i % 10 == 0)
+            lthread_sleep(1);
+    }
+
+    if (--running == 0) {
+        struct lthread_log_stats stats;
+        lthread_log_flush();
+        lthread_log_stats(&stats);
+        printf("%lu lines, %lu dropped, %lu bytes in %lu writes\n",
+            (unsigned long)stats.written, (unsigned long)stats.dropped,
+            (unsigned long)stats.bytes, (unsigned long)stats.flushes);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct lthread_log_config config;
+    lthread_t *lt = NULL;
+    long i = 0;
+    int fd = 0;
+
+    fd = open("/tmp/lthread_log.log", O_CREAT | O_TRUNC | O_WRONLY | O_APPEND,
+        0640);
+    memset(&config, 0, sizeof(config));
+    config.ring_size = 16 * 1024;
+    config.policy = LTHREAD_LOG_WAIT;
+    lthread_log_init(fd, &config);
+    for (i = 0; i < LOGGERS; i++)
+        lthread_create(&lt, logger, (void *)i);
+    lthread_run();
+
+    lthread_log_close();
+    close(fd);
+
+    return 0;
+}
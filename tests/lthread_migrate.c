@@ -0,0 +1,126 @@
+#include "lthread.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static lthread_sched_t *sched_b = NULL;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+void
+sleeper(void *arg)
+{
+    lthread_detach();
+    printf("sleeper running in pthread %lu\n", (unsigned long)pthread_self());
+    lthread_sleep(1000);
+    printf("sleeper woke up in pthread %lu\n", (unsigned long)pthread_self());
+}
+
+void
+reader(void *arg)
+{
+    int *fds = arg;
+    char buf[32] = {0};
+    lthread_detach();
+
+    lthread_read(fds[0], buf, sizeof(buf), 5000);
+    printf("reader read %s in pthread %lu\n", buf, (unsigned long)pthread_self());
+}
+
+/* someone joins us, so we're tied to this scheduler */
+void
+joined(void *arg)
+{
+    int ret = 0;
+
+    lthread_sleep(50);
+    ret = lthread_migrate_self(sched_b);
+    printf("migrating joined lthread: %d%s\n", ret,
+        ret == -1 && errno == EBUSY ? " EBUSY" : "");
+}
+
+void
+joiner(void *arg)
+{
+    lthread_detach();
+    lthread_join(arg, NULL, 1000);
+    printf("joiner back in pthread %lu\n", (unsigned long)pthread_self());
+}
+
+void
+a(void *arg)
+{
+    lthread_t *lt = NULL;
+    lthread_t *lt_reader = NULL;
+    lthread_t *lt_joiner = NULL;
+    static int fds[2];
+    lthread_detach();
+
+    lthread_create(&lt, sleeper, NULL);
+    lthread_sleep(100);
+
+    pthread_mutex_lock(&mutex);
+    while (sched_b == NULL)
+        pthread_cond_wait(&cond, &mutex);
+    pthread_mutex_unlock(&mutex);
+
+    /* move a sleeping lthread, its deadline travels with it */
+    printf("migrating sleeper: %d\n", lthread_migrate(lt, sched_b));
+
+    /* move an lthread blocked on a read, its fd interest moves too */
+    lthread_pipe(fds);
+    lthread_create(&lt_reader, reader, fds);
+    lthread_sleep(100);
+    printf("migrating reader: %d\n", lthread_migrate(lt_reader, sched_b));
+
+    lthread_create(&lt, joined, NULL);
+    lthread_create(&lt_joiner, joiner, lt);
+    lthread_sleep(100);
+
+    printf("a running in pthread %lu\n", (unsigned long)pthread_self());
+    lthread_migrate_self(sched_b);
+    printf("a moved to pthread %lu\n", (unsigned long)pthread_self());
+    lthread_write(fds[1], "hello", 5);
+}
+
+void
+keeper(void *arg)
+{
+    lthread_detach();
+
+    pthread_mutex_lock(&mutex);
+    sched_b = lthread_sched_self();
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    /* keep scheduler b alive while others migrate in */
+    lthread_sleep(2000);
+}
+
+void *
+run_b(void *arg)
+{
+    lthread_t *lt = NULL;
+
+    lthread_create(&lt, keeper, NULL);
+    lthread_run();
+
+    return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    pthread_t pthread;
+
+    pthread_create(&pthread, NULL, run_b, NULL);
+
+    lthread_create(&lt, a, NULL);
+    lthread_run();
+
+    pthread_join(pthread, NULL);
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "lthread.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define SPINS 1000
+
+static lthread_sched_t *sched_b = NULL;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static lthread_t *tail = NULL;
+static int spinning = 2;
+
+void
+tail_fn(void *arg)
+{
+    lthread_detach();
+    printf("tail ran in scheduler b: %d\n", lthread_sched_self() == sched_b);
+}
+
+/* yields over and over, a ready pass must not run it more than once */
+void
+spinner(void *arg)
+{
+    struct lthread_sched_stats stats;
+    int i = 0;
+    lthread_detach();
+
+    for (i = 0; i < SPINS; i++)
+        lthread_sleep(0);
+
+    if (--spinning == 0) {
+        lthread_sched_stats(&stats);
+        /* every yield waits for the next pass, one pass per spin */
+        printf("%d spins took %lu scheduler passes: %s\n", SPINS,
+            (unsigned long)stats.iterations,
+            stats.iterations >= SPINS ? "ok" : "pass overran its end");
+    }
+}
+
+/* first in the ready queue, migrates the last one, the pass's end marker */
+void
+mover(void *arg)
+{
+    lthread_detach();
+    printf("migrating the tail of the ready queue: %d\n",
+        lthread_migrate(tail, sched_b));
+}
+
+void
+keeper(void *arg)
+{
+    lthread_detach();
+
+    pthread_mutex_lock(&mutex);
+    sched_b = lthread_sched_self();
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+
+    lthread_sleep(500);
+}
+
+void *
+run_b(void *arg)
+{
+    lthread_t *lt = NULL;
+
+    lthread_create(&lt, keeper, NULL);
+    lthread_run();
+
+    return (NULL);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    pthread_t pthread;
+
+    pthread_create(&pthread, NULL, run_b, NULL);
+    pthread_mutex_lock(&mutex);
+    while (sched_b == NULL)
+        pthread_cond_wait(&cond, &mutex);
+    pthread_mutex_unlock(&mutex);
+
+    lthread_create(&lt, mover, NULL);
+    lthread_create(&lt, spinner, NULL);
+    lthread_create(&lt, spinner, NULL);
+    lthread_create(&tail, tail_fn, NULL);
+    lthread_run();
+
+    pthread_join(pthread, NULL);
+
+    return 0;
+}
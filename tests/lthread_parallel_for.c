@@ -0,0 +1,96 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <stdint.h>
+
+#define N 1000000
+
+static uint64_t squares[N];
+static int computing = 1;
+
+void
+square(size_t begin, size_t end, void *ctx)
+{
+    size_t i = 0;
+
+    for (i = begin; i < end; i++)
+        squares[i] = (uint64_t)i * i;
+}
+
+void
+checksum(void *arg)
+{
+    uint64_t *sum = arg;
+    size_t i = 0;
+
+    for (i = 0; i < N; i++)
+        __atomic_add_fetch(sum, squares[i] & 0xff, __ATOMIC_RELAXED);
+}
+
+void *
+count_odd(void *arg)
+{
+    uintptr_t n = 0;
+    size_t i = 0;
+
+    for (i = 0; i < N; i++)
+        n += squares[i] & 1;
+
+    return ((void *)n);
+}
+
+void
+a(void *arg)
+{
+    lthread_compute_group_t *group = NULL;
+    uint64_t sums[2] = {0, 0};
+    void *odd = NULL;
+    lthread_detach();
+
+    lthread_compute_parallel_for(0, N, 0, square, NULL);
+    printf("squares[%d] is %llu\n", N - 1,
+        (unsigned long long)squares[N - 1]);
+
+    /* fork two checksums and join them */
+    lthread_compute_group_create(&group);
+    lthread_compute_group_spawn(group, checksum, &sums[0]);
+    lthread_compute_group_spawn(group, checksum, &sums[1]);
+    lthread_compute_group_wait(group);
+    lthread_compute_group_free(group);
+    printf("checksums %llu %llu\n", (unsigned long long)sums[0],
+        (unsigned long long)sums[1]);
+
+    /* a single call on a worker's stack */
+    lthread_compute_call(count_odd, NULL, &odd);
+    printf("%lu odd squares\n", (unsigned long)(uintptr_t)odd);
+
+    computing = 0;
+}
+
+/* the scheduler keeps running other lthreads while a waits */
+void
+b(void *arg)
+{
+    lthread_detach();
+
+    while (computing)
+        lthread_sleep(1);
+    printf("b ticked while a was computing\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    void *odd = NULL;
+
+    /* outside an lthread the calling pthread blocks instead of parking */
+    lthread_compute_parallel_for(0, N, 0, square, NULL);
+    lthread_compute_call(count_odd, NULL, &odd);
+    printf("from main: %lu odd squares\n", (unsigned long)(uintptr_t)odd);
+
+    lthread_create(&lt, a, NULL);
+    lthread_create(&lt, b, NULL);
+    lthread_run();
+
+    return 0;
+}
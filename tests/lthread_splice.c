@@ -0,0 +1,83 @@
+#include "lthread.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define FILE_SIZE (4 * 1024 * 1024)
+
+/* file -> sendfile -> front[0] | front[1] -> splice -> back[0] | back[1] */
+static int file_fd = -1;
+static int front[2];
+static int back[2];
+
+void
+sender(void *arg)
+{
+    ssize_t n = lthread_sendfile(file_fd, front[0], 0, FILE_SIZE);
+    printf("sendfile sent %ld bytes\n", (long)n);
+    shutdown(front[0], SHUT_WR);
+}
+
+void
+proxy(void *arg)
+{
+    ssize_t n = lthread_splice(front[1], back[0], SIZE_MAX);
+    printf("splice moved %ld bytes\n", (long)n);
+    shutdown(back[0], SHUT_WR);
+}
+
+void
+receiver(void *arg)
+{
+    char buf[64 * 1024];
+    size_t total = 0, i = 0;
+    ssize_t n = 0;
+    int ok = 1;
+
+    while ((n = lthread_recv(back[1], buf, sizeof(buf), 0, 0)) > 0) {
+        for (i = 0; i < (size_t)n; i++)
+            if (buf[i] != (char)((total + i) % 251))
+                ok = 0;
+        total += n;
+    }
+    printf("received %lu bytes, %s\n", (unsigned long)total,
+        ok && total == FILE_SIZE ? "intact" : "CORRUPT");
+}
+
+static void
+nonblock_pair(int sv[2])
+{
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    char *data = malloc(FILE_SIZE);
+    size_t i = 0;
+
+    for (i = 0; i < FILE_SIZE; i++)
+        data[i] = (char)(i % 251);
+    file_fd = open("/tmp/lthread_splice.dat", O_CREAT | O_TRUNC | O_RDWR, 0640);
+    write(file_fd, data, FILE_SIZE);
+    free(data);
+
+    nonblock_pair(front);
+    nonblock_pair(back);
+
+    lthread_create(&lt, sender, NULL);
+    lthread_create(&lt, proxy, NULL);
+    lthread_create(&lt, receiver, NULL);
+    lthread_run();
+
+    close(file_fd);
+    unlink("/tmp/lthread_splice.dat");
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_SIZE (16 * 1024 * 1024 + 1000)
+
+void
+scan(void *arg)
+{
+    lthread_file_stream_t *s = NULL;
+    int fd = (int)(intptr_t)arg;
+    size_t total = 0, i = 0;
+    ssize_t n = 0;
+    char *buf = NULL;
+    int ok = 1, chunks = 0;
+
+    lthread_file_stream_open(&s, fd, 0, 64 * 1024, 8);
+    while ((n = lthread_file_stream_read(s, (void **)&buf)) > 0) {
+        for (i = 0; i < (size_t)n; i++)
+            if (buf[i] != (char)((total + i) % 251))
+                ok = 0;
+        total += n;
+        chunks++;
+    }
+    lthread_file_stream_close(s);
+
+    printf("streamed %lu bytes in %d chunks, %s\n", (unsigned long)total,
+        chunks, n == 0 && ok && total == FILE_SIZE ? "intact" : "CORRUPT");
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+    char *data = malloc(FILE_SIZE);
+    size_t i = 0;
+    int fd = 0;
+
+    for (i = 0; i < FILE_SIZE; i++)
+        data[i] = (char)(i % 251);
+    fd = open("/tmp/lthread_stream.dat", O_CREAT | O_TRUNC | O_RDWR, 0640);
+    write(fd, data, FILE_SIZE);
+    free(data);
+
+    lthread_create(&lt, scan, (void *)(intptr_t)fd);
+    lthread_run();
+
+    close(fd);
+    unlink("/tmp/lthread_stream.dat");
+
+    return 0;
+}
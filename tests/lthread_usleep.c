@@ -0,0 +1,63 @@
+#include "lthread.h"
+#include <stdio.h>
+#include <sys/time.h>
+
+#define ROUNDS 50
+#define USECS 200
+
+static uint64_t
+usecs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (tv.tv_sec * 1000000 + tv.tv_usec);
+}
+
+static void
+measure(const char *how)
+{
+    lthread_cond_t *cond = NULL;
+    uint64_t t1 = 0, d = 0, min = (uint64_t)-1, total = 0;
+    int i = 0, ret = 0;
+
+    for (i = 0; i < ROUNDS; i++) {
+        t1 = usecs();
+        lthread_usleep(USECS);
+        d = usecs() - t1;
+        min = d < min ? d : min;
+        total += d;
+    }
+    /* sleeps never end early, and a sub-msec one isn't rounded up to 1ms */
+    printf("%s: usleep(%d) took %lu to %lu usecs on average: %s\n", how, USECS,
+        (unsigned long)min, (unsigned long)(total / ROUNDS),
+        min >= USECS && total / ROUNDS < 1000 ? "ok" : "WRONG");
+
+    lthread_cond_create(&cond);
+    t1 = usecs();
+    ret = lthread_cond_wait_us(cond, USECS);
+    d = usecs() - t1;
+    printf("%s: cond_wait_us(%d) returned %d after %s\n", how, USECS, ret,
+        d >= USECS && d < 1000 ? "the timeout" : "the WRONG time");
+}
+
+void
+sleeper(void *arg)
+{
+    lthread_detach();
+
+    measure("epoll_pwait2");
+    lthread_sched_set_pwait2(0);
+    measure("timerfd");
+}
+
+int
+main(int argc, char **argv)
+{
+    lthread_t *lt = NULL;
+
+    lthread_create(&lt, sleeper, NULL);
+    lthread_run();
+
+    return 0;
+}